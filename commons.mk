@@ -1 +1,8 @@
 #CFLAGS = -pg
+
+#system zstd is used for trace block compression when it is available
+HAVE_ZSTD := $(shell g++ -E -include zstd.h -x c++ /dev/null > /dev/null 2>&1 && echo 1)
+ifeq ($(HAVE_ZSTD), 1)
+CFLAGS += -DBININST_HAVE_ZSTD
+CODEC_LIBS = -lzstd
+endif
@@ -0,0 +1,24 @@
+#pragma once
+
+//Region of interest API for traced programs.
+//Memory accesses are recorded only between bininst_roi_begin() and bininst_roi_end(),
+//code outside regions runs without access instrumentation. Regions may be nested,
+//recorded windows keep the name of the region. The functions do nothing unless the
+//program runs under the tool, which finds them by name.
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((noinline, used)) static void bininst_roi_begin(const char* name)
+{
+    __asm__ volatile("" : : "r"(name) : "memory");
+}
+
+__attribute__((noinline, used)) static void bininst_roi_end(void)
+{
+    __asm__ volatile("" : : : "memory");
+}
+
+#ifdef __cplusplus
+}
+#endif
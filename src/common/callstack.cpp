@@ -113,3 +113,26 @@ bool CallStackGlobal::empty(int threadId) const
 {
     return callStacks[threadId].empty();
 }
+
+void CallStackGlobal::handleEvent(const Event& e, const dbginfo::DebugContext& dbgContext)
+{
+    if (e.type != EventType::Call && e.type != EventType::Ret)
+    {
+        return;
+    }
+    auto* funcInfo = dbgContext.findFuncById(e.routineEvent.routineId);
+    if (!funcInfo)
+    {
+        return;
+    }
+    void* frameBase = (char*)e.routineEvent.stackPointerRegister + funcInfo->stackOffset;
+    FuncCall funcCall(funcInfo, frameBase);
+    if (e.type == EventType::Call)
+    {
+        push(e.threadId, funcCall);
+    }
+    else
+    {
+        pop(e.threadId, funcCall);
+    }
+}
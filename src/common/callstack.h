@@ -37,4 +37,6 @@ struct CallStackGlobal
     const FuncCall& top(int threadId) const;
     bool empty(int threadId) const;
     void clear();
+    //tracks Call/Ret events of the routines known to dbgContext
+    void handleEvent(const Event& e, const dbginfo::DebugContext& dbgContext);
 };
@@ -5,5 +5,7 @@
 static std::string BIN_EVENT_PATH = "bin/event.bin";
 static std::string EVENT_REF_PATH = "bin/event.ref";
 static std::string DEBUG_INFO_PATH = "bin/dbginfo.bin";
+//written instead of the trace in the profile mode of the tool
+static std::string PROFILE_PATH = "bin/profile.bin";
 
 static int MAX_THREADS = 244;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <string>
@@ -6,10 +7,19 @@ using namespace std;
 
 namespace dbginfo
 {
+    DebugContext::DebugContext()
+    {
+        clearPageCache();
+    }
+
     DebugContext::DebugContext(DebugContext&& d) :
         funcs(std::move(d.funcs)),
         vars(std::move(d.vars)),
-        instBindings(std::move(d.instBindings))
+        insts(std::move(d.insts)),
+        instIds(std::move(d.instIds)),
+        instLines(std::move(d.instLines)),
+        sourceFiles(std::move(d.sourceFiles)),
+        sourceFileIds(std::move(d.sourceFileIds))
     {
         for (auto& e: funcs)
         {
@@ -19,13 +29,18 @@ namespace dbginfo
         {
             idVars[v.id] = &v;
         }
+        indexVars();
     }
 
     DebugContext& DebugContext::operator=(DebugContext&& d)
     {
         funcs = std::move(d.funcs);
         vars = std::move(d.vars);
-        instBindings = std::move(d.instBindings);
+        insts = std::move(d.insts);
+        instIds = std::move(d.instIds);
+        instLines = std::move(d.instLines);
+        sourceFiles = std::move(d.sourceFiles);
+        sourceFileIds = std::move(d.sourceFileIds);
 
         for (auto& e: funcs)
         {
@@ -35,6 +50,7 @@ namespace dbginfo
         {
             idVars[v.id] = &v;
         }
+        indexVars();
         return *this;
     }
 
@@ -65,9 +81,18 @@ namespace dbginfo
         auto ret = vars.insert(varInfo);
         if (varInfo.parent)
         {
-            const_cast<FuncInfo*>(varInfo.parent)->vars.push_back(&*ret.first);
+            auto* parent = const_cast<FuncInfo*>(varInfo.parent);
+            parent->addVar(&*ret.first);
+            if (varsIndexed)
+            {
+                parent->indexFrame();
+            }
         }
         idVars[varInfo.id] = &*ret.first;
+        if (varsIndexed && varInfo.type == StorageType::Static)
+        {
+            indexStaticVars();
+        }
         return &*ret.first;
     }
 
@@ -77,36 +102,157 @@ namespace dbginfo
         return it != idVars.end() ? it->second : nullptr;
     }
 
-    const VarInfo* DebugContext::findVarByAddress(void* addr) const
+    void DebugContext::clearPageCache()
     {
-        for (auto& v : vars)
+        for (auto& e: pageCache)
+        {
+            e.store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    void DebugContext::indexVars()
+    {
+        for (auto& e: funcs)
+        {
+            e.second.indexFrame();
+        }
+        indexStaticVars();
+        varsIndexed = true;
+    }
+
+    void DebugContext::indexStaticVars()
+    {
+        staticVars.clear();
+        for (auto& v: vars)
         {
             if (v.type == StorageType::Static)
             {
-                char* varAddr = (char*)v.stackOffset;
-                if (varAddr <= addr && addr < varAddr + v.size)
+                staticVars.push_back(&v);
+            }
+        }
+        std::sort(staticVars.begin(), staticVars.end(), [](const VarInfo* a, const VarInfo* b)
+        {
+            return (uint64_t)a->stackOffset < (uint64_t)b->stackOffset;
+        });
+        staticEnds.resize(staticVars.size());
+        staticDisjoint.resize(staticVars.size());
+        uint64_t maxEnd = 0;
+        for (size_t i = 0; i < staticVars.size(); i++)
+        {
+            uint64_t begin = staticVars[i]->stackOffset;
+            uint64_t end = begin + staticVars[i]->size;
+            //an earlier variable reaches into it or the next one starts inside it
+            bool overlapsPrevious = i > 0 && staticEnds[i - 1] > begin;
+            bool overlapsNext = i + 1 < staticVars.size() && (uint64_t)staticVars[i + 1]->stackOffset < end;
+            staticDisjoint[i] = !overlapsPrevious && !overlapsNext;
+            maxEnd = std::max(maxEnd, end);
+            staticEnds[i] = maxEnd;
+        }
+        clearPageCache();
+    }
+
+    //of overlapping variables (e.g. members of a COMMON block and the block) the one starting last is found
+    const VarInfo* DebugContext::findVarByAddress(void* addr) const
+    {
+        uint64_t a = (uint64_t)addr;
+        auto& cached = pageCache[(a >> 12) % PageCacheSize];
+        int hit = cached.load(std::memory_order_relaxed);
+        if (hit >= 0 && hit < (int)staticVars.size())
+        {
+            const VarInfo* v = staticVars[hit];
+            if ((uint64_t)v->stackOffset <= a && a < (uint64_t)v->stackOffset + v->size)
+            {
+                return v;
+            }
+        }
+        //last variable starting at or below the address, then back while earlier ones may reach it
+        auto it = std::upper_bound(staticVars.begin(), staticVars.end(), a, [](uint64_t a, const VarInfo* v)
+        {
+            return a < (uint64_t)v->stackOffset;
+        });
+        for (int i = (int)(it - staticVars.begin()) - 1; i >= 0 && staticEnds[i] > a; i--)
+        {
+            const VarInfo* v = staticVars[i];
+            if (a < (uint64_t)v->stackOffset + v->size)
+            {
+                if (staticDisjoint[i])
                 {
-                    return &v;
+                    cached.store(i, std::memory_order_relaxed);
                 }
+                return v;
             }
         }
         return nullptr;
     }
 
-    void DebugContext::setInstBinding(uint64_t inst, const SourceLocation& sourceLocation)
+    std::vector<const VarInfo*> DebugContext::findVarsByName(const std::string& name) const
+    {
+        std::vector<const VarInfo*> found;
+        for (auto& v : vars)
+        {
+            if (v.name == name)
+            {
+                found.push_back(&v);
+            }
+        }
+        return found;
+    }
+
+    void DebugContext::setInstSourceLocation(uint32_t id, const SourceLocation& sourceLocation)
     {
         assert(sourceLocation);
-        auto ret = instBindings.insert(make_pair(inst, sourceLocation));
-        if (!ret.second)
+        assert(id < instLines.size());
+        auto ret = sourceFileIds.insert(make_pair(sourceLocation.fileName, (uint32_t)sourceFiles.size()));
+        if (ret.second)
+        {
+            sourceFiles.push_back(sourceLocation.fileName);
+        }
+        instLines[id].file = ret.first->second;
+        instLines[id].line = sourceLocation.line;
+    }
+
+    bool DebugContext::hasInstSourceLocation(uint32_t id) const
+    {
+        return id < instLines.size() && instLines[id].file != InstLine::NoFile;
+    }
+
+    SourceLocation DebugContext::getInstSourceLocation(uint32_t id) const
+    {
+        if (!hasInstSourceLocation(id))
+        {
+            return SourceLocation();
+        }
+        return SourceLocation(sourceFiles[instLines[id].file], instLines[id].line);
+    }
+
+    uint32_t DebugContext::addInst(uint64_t instAddr)
+    {
+        if (insts.empty())
         {
-            assert(sourceLocation == ret.first->second);
+            insts.push_back(0);
+            instLines.push_back(InstLine());
+            instIds[0] = 0;
         }
+        auto ret = instIds.insert(make_pair(instAddr, (uint32_t)insts.size()));
+        if (ret.second)
+        {
+            //memory events keep 24 bits of the id
+            assert(insts.size() < (1 << 24));
+            insts.push_back(instAddr);
+            instLines.push_back(InstLine());
+        }
+        return ret.first->second;
+    }
+
+    uint64_t DebugContext::findInstById(uint32_t id) const
+    {
+        return id < insts.size() ? insts[id] : 0;
     }
 
-    SourceLocation DebugContext::getInstBinding(uint64_t inst) const
+    uint32_t DebugContext::findInstId(uint64_t instAddr) const
     {
-        auto it = instBindings.find(inst);
-        return it == instBindings.end() ? SourceLocation() : it->second;
+        auto it = instIds.find(instAddr);
+        return it != instIds.end() ? it->second : 0;
     }
 
     void DebugContext::save(std::ostream& out) const
@@ -124,11 +270,19 @@ namespace dbginfo
         {
             varInfo.save(out, *this);
         }
-        utils::save(instBindings.size(), out);
-        for (auto e: instBindings)
+        utils::save(insts.size(), out);
+        for (uint64_t instAddr: insts)
         {
-            utils::save(e.first, out);
-            e.second.save(out);
+            utils::save(instAddr, out);
+        }
+        utils::save(sourceFiles.size(), out);
+        for (auto& fileName: sourceFiles)
+        {
+            utils::save(fileName, out);
+        }
+        for (auto& instLine: instLines)
+        {
+            utils::save(instLine, out);
         }
     }
 
@@ -154,16 +308,26 @@ namespace dbginfo
             idVars.insert(make_pair(varInfo.id, &(*ret.first)));
             if (ret.first->parent)
             {
-                const_cast<FuncInfo*>(ret.first->parent)->vars.push_back(&*ret.first);
+                const_cast<FuncInfo*>(ret.first->parent)->addVar(&*ret.first);
             }
         }
-        auto nInstBindings = utils::load<std::map<uint64_t, SourceLocation>::size_type>(in);
-        for (int i = 0; i < nInstBindings; i++)
+        insts.resize(utils::load<std::vector<uint64_t>::size_type>(in));
+        for (uint32_t i = 0; i < insts.size(); i++)
+        {
+            insts[i] = utils::load<uint64_t>(in);
+            instIds[insts[i]] = i;
+        }
+        sourceFiles.resize(utils::load<std::vector<std::string>::size_type>(in));
+        for (uint32_t i = 0; i < sourceFiles.size(); i++)
+        {
+            sourceFiles[i] = utils::load<std::string>(in);
+            sourceFileIds[sourceFiles[i]] = i;
+        }
+        instLines.resize(insts.size());
+        for (auto& instLine: instLines)
         {
-            auto inst = utils::load<uint64_t>(in);
-            SourceLocation sourceLoc;
-            sourceLoc.load(in);
-            instBindings[inst] = sourceLoc;
+            instLine = utils::load<InstLine>(in);
         }
+        indexVars();
     }
 } //namespace dbginfo
@@ -1,7 +1,9 @@
 #pragma once
+#include <atomic>
 #include <fstream>
 #include <map>
 #include <set>
+#include <vector>
 #include "funcinfo.h"
 #include "varinfo.h"
 #include "common/event/event.h"
@@ -14,13 +16,42 @@ namespace dbginfo
         std::map<int, const FuncInfo*> idFuncs;
         std::set<VarInfo> vars;
         std::map<int, const VarInfo*> idVars;
-        std::map<uint64_t, SourceLocation> instBindings;
+        //instructions are interned at instrumentation time, events keep the id
+        std::vector<uint64_t> insts;
+        std::map<uint64_t, uint32_t> instIds;
+        //source line of each instruction by id, file names are shared
+        struct InstLine
+        {
+            static const uint32_t NoFile = UINT32_MAX;
+
+            uint32_t file = NoFile;
+            int line = 0;
+        };
+        std::vector<InstLine> instLines;
+        std::vector<std::string> sourceFiles;
+        std::map<std::string, uint32_t> sourceFileIds;
+
+        //static variables sorted by address for findVarByAddress
+        std::vector<const VarInfo*> staticVars;
+        //largest end address of staticVars up to each index, bounds the scan over overlapping variables
+        std::vector<uint64_t> staticEnds;
+        //variables overlapping no other one, only they can be cached
+        std::vector<bool> staticDisjoint;
+        bool varsIndexed = false;
+        //index in staticVars of the last variable found in a page, a hit is valid only if it
+        //contains the address, so concurrent lookups need no lock
+        static const int PageCacheSize = 1024;
+        mutable std::atomic<int> pageCache[PageCacheSize];
 
         DebugContext(const DebugContext& d) = delete;
         DebugContext& operator=(const DebugContext& d) = delete;
+        void clearPageCache();
+        //called once all variables of the debug info are added
+        void indexVars();
+        void indexStaticVars();
 
     public:
-        DebugContext() = default;
+        DebugContext();
         DebugContext(DebugContext&& d);
         DebugContext& operator=(DebugContext&& d);
         const FuncInfo* findFuncByName(const std::string& name) const;
@@ -29,8 +60,16 @@ namespace dbginfo
         const VarInfo* addVar(const VarInfo& f);
         const VarInfo* findVarById(int id) const;
         const VarInfo* findVarByAddress(void* addr) const;
-        void setInstBinding(uint64_t inst, const SourceLocation& sourceLocation);
-        SourceLocation getInstBinding(uint64_t inst) const;
+        //names of locals are not unique
+        std::vector<const VarInfo*> findVarsByName(const std::string& name) const;
+        void setInstSourceLocation(uint32_t id, const SourceLocation& sourceLocation);
+        bool hasInstSourceLocation(uint32_t id) const;
+        SourceLocation getInstSourceLocation(uint32_t id) const;
+        //id 0 is reserved for events without an instruction
+        uint32_t addInst(uint64_t instAddr);
+        uint64_t findInstById(uint32_t id) const;
+        //0 if the instruction wasn't interned
+        uint32_t findInstId(uint64_t instAddr) const;
         void save(std::ostream& out) const;
         void load(std::istream& in);
     };
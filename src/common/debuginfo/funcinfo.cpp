@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include "debugcontext.h"
 #include "funcinfo.h"
@@ -13,6 +14,50 @@ namespace dbginfo
         id = globalId++;
     }
 
+    void FuncInfo::addVar(const VarInfo* varInfo)
+    {
+        vars.push_back(varInfo);
+    }
+
+    void FuncInfo::indexFrame()
+    {
+        frameVars.clear();
+        //static locals have absolute addresses
+        for (auto* varInfo: vars)
+        {
+            if (varInfo->type != StorageType::Static)
+            {
+                frameVars.push_back(varInfo);
+            }
+        }
+        std::stable_sort(frameVars.begin(), frameVars.end(), [](const VarInfo* a, const VarInfo* b)
+        {
+            return a->stackOffset < b->stackOffset;
+        });
+        frameEnds.resize(frameVars.size());
+        for (size_t i = 0; i < frameVars.size(); i++)
+        {
+            ssize_t end = frameVars[i]->stackOffset + (ssize_t)frameVars[i]->size;
+            frameEnds[i] = i > 0 ? std::max(frameEnds[i - 1], end) : end;
+        }
+    }
+
+    const VarInfo* FuncInfo::findLocal(ssize_t offset) const
+    {
+        auto it = std::upper_bound(frameVars.begin(), frameVars.end(), offset, [](ssize_t offset, const VarInfo* v)
+        {
+            return offset < v->stackOffset;
+        });
+        for (int i = (int)(it - frameVars.begin()) - 1; i >= 0 && frameEnds[i] > offset; i--)
+        {
+            if (offset < frameVars[i]->stackOffset + (ssize_t)frameVars[i]->size)
+            {
+                return frameVars[i];
+            }
+        }
+        return nullptr;
+    }
+
     void FuncInfo::save(std::ostream& out, const DebugContext& dbgCtxt) const
     {
         utils::save(id, out);
@@ -15,9 +15,18 @@ namespace dbginfo
         std::string name;
         std::vector<const VarInfo*> vars;
         ssize_t stackOffset;
+        //frame layout: locals sorted by offset from the frame base, with the largest
+        //end offset up to each of them to bound the scan over overlapping scopes
+        std::vector<const VarInfo*> frameVars;
+        std::vector<ssize_t> frameEnds;
 
         FuncInfo() = default;
         FuncInfo(const std::string& name, ssize_t stackOffset);
+        void addVar(const VarInfo* varInfo);
+        //builds the frame layout, called once all locals are added
+        void indexFrame();
+        //local containing the offset from the frame base, the one starting last if they overlap
+        const VarInfo* findLocal(ssize_t offset) const;
         void save(std::ostream& out, const DebugContext& dbgCtxt) const;
         void load(std::istream& in, const DebugContext& dbgCtxt);
     };
@@ -0,0 +1,229 @@
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "annotation.h"
+#include "common/utils.h"
+
+static bool isMemoryEvent(const Event& e)
+{
+    return e.type == EventType::Read || e.type == EventType::Write ||
+           e.type == EventType::Alloc || e.type == EventType::Free;
+}
+
+//------------------------------------------------------------------------------
+//AnnotationWriter
+//------------------------------------------------------------------------------
+
+void AnnotationWriter::setCompression(trace::Codec codec, int level)
+{
+    this->codec = trace::isCodecAvailable(codec) ? codec : trace::Codec::None;
+    this->level = level;
+}
+
+bool AnnotationWriter::open(const std::string& path)
+{
+    //a sidecar left open is incomplete and dropped
+    out.close();
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out.good())
+    {
+        return false;
+    }
+    index.clear();
+    blooms.clear();
+    utils::save(trace::AnnotationHeader(), out);
+    return true;
+}
+
+void AnnotationWriter::close(uint64_t traceSize)
+{
+    if (out.is_open())
+    {
+        writeIndex();
+        trace::AnnotationHeader header;
+        header.traceSize = traceSize;
+        out.seekp(0);
+        utils::save(header, out);
+        out.close();
+    }
+}
+
+bool AnnotationWriter::isOpen() const
+{
+    return out.is_open();
+}
+
+void AnnotationWriter::writeBlock(const Event* events, size_t eventCount)
+{
+    assert(eventCount <= UINT32_MAX);
+    trace::BlockSummary summary;
+    payload.clear();
+    int prevVarId = -1;
+    for (size_t i = 0; i < eventCount; i++)
+    {
+        if (isMemoryEvent(events[i]))
+        {
+            int varId = events[i].memoryEvent.varId;
+            trace::putVarint(payload, trace::zigzag((int64_t)varId - prevVarId));
+            summary.addVar(varId);
+            prevVarId = varId;
+        }
+    }
+
+    trace::BlockHeader header;
+    header.eventCount = eventCount;
+    header.rawSize = payload.size();
+    auto* data = &payload;
+    if (trace::compressBlock(codec, level, payload.data(), payload.size(), compressed))
+    {
+        header.codec = codec;
+        header.level = level;
+        data = &compressed;
+    }
+    header.payloadSize = data->size();
+
+    trace::BlockIndexEntry entry;
+    entry.offset = (uint64_t)out.tellp() + sizeof(header);
+    entry.header = header;
+    index.push_back(entry);
+    blooms.insert(blooms.end(), summary.varBloom, summary.varBloom + trace::BlockSummary::BloomWords);
+
+    utils::save(header, out);
+    out.write((char*)data->data(), data->size());
+}
+
+void AnnotationWriter::writeIndex()
+{
+    trace::IndexTrailer trailer;
+    trailer.indexOffset = out.tellp();
+    trailer.blockCount = index.size();
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        utils::save(index[i], out);
+        out.write((char*)&blooms[i * trace::BlockSummary::BloomWords],
+                  trace::BlockSummary::BloomWords * sizeof(uint64_t));
+    }
+    utils::save(trailer, out);
+}
+
+//------------------------------------------------------------------------------
+//AnnotationReader
+//------------------------------------------------------------------------------
+
+bool AnnotationReader::open(const std::string& path, uint64_t traceSize)
+{
+    close();
+    if (!file.open(path))
+    {
+        return false;
+    }
+    trace::AnnotationHeader header;
+    if (file.size() < sizeof(header))
+    {
+        close();
+        return false;
+    }
+    memcpy(&header, file.begin(), sizeof(header));
+    if (header.magic != trace::AnnotationMagic || header.version != trace::AnnotationVersion ||
+        header.traceSize != traceSize || !(header.columns & trace::AnnotationVarId) || !loadIndex())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool AnnotationReader::loadIndex()
+{
+    trace::IndexTrailer trailer;
+    if (file.size() < sizeof(trace::AnnotationHeader) + sizeof(trailer))
+    {
+        return false;
+    }
+    size_t trailerOffset = file.size() - sizeof(trailer);
+    memcpy(&trailer, file.begin() + trailerOffset, sizeof(trailer));
+    if (trailer.magic != trace::IndexMagic || trailer.indexOffset > trailerOffset)
+    {
+        return false;
+    }
+    std::istringstream in(std::string(file.begin() + trailer.indexOffset, trailerOffset - trailer.indexOffset));
+    for (uint64_t i = 0; i < trailer.blockCount; i++)
+    {
+        index.push_back(utils::load<trace::BlockIndexEntry>(in));
+        blooms.resize(blooms.size() + trace::BlockSummary::BloomWords);
+        in.read((char*)&blooms[i * trace::BlockSummary::BloomWords],
+                trace::BlockSummary::BloomWords * sizeof(uint64_t));
+        if (!in.good())
+        {
+            return false;
+        }
+        auto& entry = index.back();
+        if (entry.offset > trailer.indexOffset || entry.header.payloadSize > trailer.indexOffset - entry.offset)
+        {
+            throw std::runtime_error("corrupt annotations: block " + std::to_string(i) + " of the index is out of the file");
+        }
+    }
+    return true;
+}
+
+void AnnotationReader::close()
+{
+    file.close();
+    index.clear();
+    blooms.clear();
+}
+
+bool AnnotationReader::isOpen() const
+{
+    return file.isOpen();
+}
+
+size_t AnnotationReader::getBlockCount() const
+{
+    return index.size();
+}
+
+uint32_t AnnotationReader::getEventCount(size_t i) const
+{
+    return index[i].header.eventCount;
+}
+
+const uint64_t* AnnotationReader::getVarBloom(size_t i) const
+{
+    return &blooms[i * trace::BlockSummary::BloomWords];
+}
+
+void AnnotationReader::apply(size_t i, Event* events, size_t eventCount)
+{
+    auto& entry = index[i];
+    assert(entry.header.eventCount == eventCount);
+    auto* p = (const uint8_t*)file.begin() + entry.offset;
+    //a varint of 64 bits per event at most
+    bool sizesMatch = entry.header.rawSize <= eventCount * 10 &&
+                      (entry.header.codec != trace::Codec::None || entry.header.rawSize == entry.header.payloadSize);
+    if (!sizesMatch)
+    {
+        throw std::runtime_error("corrupt annotations: raw size of block " + std::to_string(i) + " doesn't match its events");
+    }
+    if (entry.header.codec != trace::Codec::None)
+    {
+        decompressed.resize(entry.header.rawSize);
+        if (!trace::decompressBlock(entry.header.codec, p, entry.header.payloadSize,
+                                    decompressed.data(), decompressed.size()))
+        {
+            throw std::runtime_error("corrupt annotations: block " + std::to_string(i) + " can't be decompressed");
+        }
+        p = decompressed.data();
+    }
+    auto* end = p + entry.header.rawSize;
+    int varId = -1;
+    for (size_t j = 0; j < eventCount; j++)
+    {
+        if (isMemoryEvent(events[j]))
+        {
+            varId += (int)trace::unzigzag(trace::getVarint(p, end));
+            events[j].memoryEvent.varId = varId;
+        }
+    }
+}
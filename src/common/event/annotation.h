@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "blocksummary.h"
+#include "event.h"
+#include "mappedfile.h"
+#include "traceformat.h"
+
+//Annotation sidecar layout:
+//  AnnotationHeader
+//  (BlockHeader payload)*
+//  index: (BlockIndexEntry varBloom)*
+//  IndexTrailer
+//Blocks are aligned with the blocks of the trace they annotate, so a block of annotations
+//is joined with a trace block without touching the rest of the file.
+//Payload holds one record per memory event: zigzag varint delta of varId to the previous one.
+//Sidecar without the index is incomplete and is ignored.
+namespace trace
+{
+    const uint32_t AnnotationMagic = 0x4e4e4154; //"TANN"
+    const uint32_t AnnotationVersion = 1;
+
+    enum AnnotationColumns : uint32_t
+    {
+        AnnotationVarId = 0x1
+    };
+
+    struct AnnotationHeader
+    {
+        uint32_t magic = AnnotationMagic;
+        uint32_t version = AnnotationVersion;
+        uint32_t columns = AnnotationVarId;
+        uint32_t reserved = 0;
+        //size of the annotated trace, catches sidecars left from a previous run
+        uint64_t traceSize = 0;
+    };
+} //namespace trace
+
+class AnnotationWriter
+{
+    std::ofstream out;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> compressed;
+    trace::Codec codec = trace::Codec::None;
+    int level = 1;
+    std::vector<trace::BlockIndexEntry> index;
+    std::vector<uint64_t> blooms;
+
+    void writeIndex();
+
+public:
+    void setCompression(trace::Codec codec, int level);
+    bool open(const std::string& path);
+    //size of the annotated trace is recorded on close, when the trace is complete
+    void close(uint64_t traceSize);
+    bool isOpen() const;
+    void writeBlock(const Event* events, size_t eventCount);
+};
+
+class AnnotationReader
+{
+    MappedFile file;
+    std::vector<trace::BlockIndexEntry> index;
+    std::vector<uint64_t> blooms;
+    std::vector<uint8_t> decompressed;
+
+    bool loadIndex();
+
+public:
+    bool open(const std::string& path, uint64_t traceSize);
+    void close();
+    bool isOpen() const;
+    size_t getBlockCount() const;
+    uint32_t getEventCount(size_t i) const;
+    const uint64_t* getVarBloom(size_t i) const;
+    //fills in varId of memory events of the i-th block
+    void apply(size_t i, Event* events, size_t eventCount);
+};
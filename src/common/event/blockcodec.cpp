@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cstring>
+#ifdef BININST_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "blockcodec.h"
+
+namespace trace
+{
+    //------------------------------------------------------------------------------
+    //Built-in LZ codec
+    //------------------------------------------------------------------------------
+    //A block is a sequence of (token, literals, offset, match) entries in LZ4 manner:
+    //token keeps literal length in the high nibble and match length - MinMatch in the low one,
+    //nibble value 15 means the length continues in the following bytes (255 per byte).
+    //The last entry has literals only.
+
+    static const size_t LzMinMatch = 4;
+    static const size_t LzMaxOffset = 65535;
+
+    static uint32_t read32(const uint8_t* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void putLength(std::vector<uint8_t>& out, size_t len)
+    {
+        while (len >= 255)
+        {
+            out.push_back(255);
+            len -= 255;
+        }
+        out.push_back((uint8_t)len);
+    }
+
+    static bool getLength(const uint8_t*& p, const uint8_t* end, size_t* len)
+    {
+        uint8_t b;
+        do
+        {
+            if (p == end)
+            {
+                return false;
+            }
+            b = *p++;
+            *len += b;
+        }
+        while (b == 255);
+        return true;
+    }
+
+    static void putSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t litLen,
+                            size_t offset, size_t matchLen)
+    {
+        size_t matchCode = matchLen ? matchLen - LzMinMatch : 0;
+        out.push_back((uint8_t)(std::min<size_t>(litLen, 15) << 4 | std::min<size_t>(matchCode, 15)));
+        if (litLen >= 15)
+        {
+            putLength(out, litLen - 15);
+        }
+        out.insert(out.end(), literals, literals + litLen);
+        if (matchLen == 0)
+        {
+            return;
+        }
+        out.push_back((uint8_t)offset);
+        out.push_back((uint8_t)(offset >> 8));
+        if (matchCode >= 15)
+        {
+            putLength(out, matchCode - 15);
+        }
+    }
+
+    static bool lzCompress(int level, const uint8_t* src, size_t n, std::vector<uint8_t>& out)
+    {
+        //higher levels use bigger hash table and don't skip over incompressible data
+        int hashLog = 12 + std::min(std::max(level, 1), 8);
+        int skipLog = level <= 1 ? 5 : 8;
+        std::vector<uint32_t> table((size_t)1 << hashLog, UINT32_MAX);
+
+        out.clear();
+        size_t anchor = 0;
+        size_t i = 0;
+        while (i + LzMinMatch <= n)
+        {
+            uint32_t seq = read32(src + i);
+            uint32_t h = (seq * 2654435761u) >> (32 - hashLog);
+            uint32_t cand = table[h];
+            table[h] = (uint32_t)i;
+            if (cand != UINT32_MAX && i - cand <= LzMaxOffset && read32(src + cand) == seq)
+            {
+                size_t len = LzMinMatch;
+                while (i + len < n && src[cand + len] == src[i + len])
+                {
+                    len++;
+                }
+                putSequence(out, src + anchor, i - anchor, i - cand, len);
+                i += len;
+                anchor = i;
+            }
+            else
+            {
+                i += 1 + ((i - anchor) >> skipLog);
+            }
+            if (out.size() >= n)
+            {
+                return false;
+            }
+        }
+        putSequence(out, src + anchor, n - anchor, 0, 0);
+        return out.size() < n;
+    }
+
+    static bool lzDecompress(const uint8_t* p, size_t srcSize, uint8_t* dst, size_t dstSize)
+    {
+        const uint8_t* end = p + srcSize;
+        size_t pos = 0;
+        while (p < end)
+        {
+            uint8_t token = *p++;
+            size_t litLen = token >> 4;
+            if (litLen == 15 && !getLength(p, end, &litLen))
+            {
+                return false;
+            }
+            if (litLen > (size_t)(end - p) || litLen > dstSize - pos)
+            {
+                return false;
+            }
+            memcpy(dst + pos, p, litLen);
+            p += litLen;
+            pos += litLen;
+            if (pos == dstSize)
+            {
+                return p == end;
+            }
+            if (end - p < 2)
+            {
+                return false;
+            }
+            size_t offset = p[0] | (size_t)p[1] << 8;
+            p += 2;
+            size_t matchLen = token & 0xf;
+            if (matchLen == 15 && !getLength(p, end, &matchLen))
+            {
+                return false;
+            }
+            matchLen += LzMinMatch;
+            if (offset == 0 || offset > pos || matchLen > dstSize - pos)
+            {
+                return false;
+            }
+            //byte by byte since the match may overlap the output
+            for (size_t k = 0; k < matchLen; k++, pos++)
+            {
+                dst[pos] = dst[pos - offset];
+            }
+        }
+        return pos == dstSize;
+    }
+
+    //------------------------------------------------------------------------------
+    //Codec dispatch
+    //------------------------------------------------------------------------------
+
+    std::string to_string(Codec codec)
+    {
+        switch (codec)
+        {
+            case Codec::None:
+                return "none";
+            case Codec::Lz:
+                return "lz";
+            case Codec::Zstd:
+                return "zstd";
+        }
+        return "Unknown Codec: " + std::to_string((int)codec);
+    }
+
+    bool parseCodec(const std::string& name, Codec* codec)
+    {
+        for (auto c: {Codec::None, Codec::Lz, Codec::Zstd})
+        {
+            if (to_string(c) == name)
+            {
+                *codec = c;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isCodecAvailable(Codec codec)
+    {
+#ifdef BININST_HAVE_ZSTD
+        const bool haveZstd = true;
+#else
+        const bool haveZstd = false;
+#endif
+        return codec != Codec::Zstd || haveZstd;
+    }
+
+    bool compressBlock(Codec codec, int level, const uint8_t* src, size_t srcSize, std::vector<uint8_t>& out)
+    {
+        switch (codec)
+        {
+            case Codec::None:
+                return false;
+            case Codec::Lz:
+                return lzCompress(level, src, srcSize, out);
+            case Codec::Zstd:
+            {
+#ifdef BININST_HAVE_ZSTD
+                out.resize(ZSTD_compressBound(srcSize));
+                size_t ret = ZSTD_compress(out.data(), out.size(), src, srcSize, level);
+                if (ZSTD_isError(ret) || ret >= srcSize)
+                {
+                    return false;
+                }
+                out.resize(ret);
+                return true;
+#else
+                return false;
+#endif
+            }
+        }
+        return false;
+    }
+
+    bool decompressBlock(Codec codec, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+    {
+        switch (codec)
+        {
+            case Codec::None:
+                if (srcSize != dstSize)
+                {
+                    return false;
+                }
+                memcpy(dst, src, srcSize);
+                return true;
+            case Codec::Lz:
+                return lzDecompress(src, srcSize, dst, dstSize);
+            case Codec::Zstd:
+            {
+#ifdef BININST_HAVE_ZSTD
+                size_t ret = ZSTD_decompress(dst, dstSize, src, srcSize);
+                return !ZSTD_isError(ret) && ret == dstSize;
+#else
+                return false;
+#endif
+            }
+        }
+        return false;
+    }
+} //namespace trace
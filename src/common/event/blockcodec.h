@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace trace
+{
+    enum class Codec : uint8_t
+    {
+        None,
+        Lz,
+        Zstd
+    };
+
+    std::string to_string(Codec codec);
+    bool parseCodec(const std::string& name, Codec* codec);
+    bool isCodecAvailable(Codec codec);
+
+    //returns false if the codec can't make the block smaller; out is left unspecified then
+    bool compressBlock(Codec codec, int level, const uint8_t* src, size_t srcSize, std::vector<uint8_t>& out);
+    bool decompressBlock(Codec codec, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+} //namespace trace
@@ -0,0 +1,107 @@
+#include <cassert>
+#include "blockprefetcher.h"
+#include "common/utils.h"
+#include "tracereader.h"
+
+BlockPrefetcher::BlockPrefetcher(size_t depth) :
+    depth(depth),
+    slots(depth + 1)
+{
+    assert(depth > 0);
+}
+
+BlockPrefetcher::~BlockPrefetcher()
+{
+    stop();
+}
+
+void BlockPrefetcher::start(const TraceReader& reader, const std::vector<size_t>& plan)
+{
+    stop();
+    this->reader = &reader;
+    this->plan = plan;
+    produced = 0;
+    taken = 0;
+    stopping = false;
+    error = nullptr;
+    worker = std::thread(&BlockPrefetcher::run, this);
+}
+
+void BlockPrefetcher::stop()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    takenCond.notify_all();
+    worker.join();
+}
+
+void BlockPrefetcher::run()
+{
+    std::vector<uint8_t> scratch;
+    trace::BlockDecoder decoder;
+    for (size_t i = 0; i < plan.size(); i++)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            //the block taken last is still in use, so it counts as occupied
+            takenCond.wait(lock, [&] { return stopping || produced < taken + depth; });
+            if (stopping)
+            {
+                return;
+            }
+        }
+        auto& slot = slots[i % slots.size()];
+        try
+        {
+            slot.events = reader->decodeBlock(plan[i], slot.decoded, scratch, decoder);
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+            }
+            producedCond.notify_one();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            produced++;
+        }
+        producedCond.notify_one();
+    }
+}
+
+Event* BlockPrefetcher::take(size_t block)
+{
+    assert(taken < plan.size() && plan[taken] == block);
+    Event* events;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (produced <= taken)
+        {
+            double t = utils::dsecnd();
+            producedCond.wait(lock, [&] { return produced > taken || error; });
+            stallTime += utils::dsecnd() - t;
+        }
+        if (produced <= taken)
+        {
+            std::rethrow_exception(error);
+        }
+        events = slots[taken % slots.size()].events;
+        taken++;
+    }
+    takenCond.notify_one();
+    return events;
+}
+
+double BlockPrefetcher::getStallTime() const
+{
+    return stallTime;
+}
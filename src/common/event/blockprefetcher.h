@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "event.h"
+#include "traceformat.h"
+
+class TraceReader;
+
+//Loads trace blocks on a background thread ahead of the consumer.
+//Blocks are delivered in the order of the plan given to start(); events of a block stay valid
+//until the next block is taken, so depth + 1 buffers are used
+class BlockPrefetcher
+{
+    struct Slot
+    {
+        std::vector<Event> decoded;
+        Event* events = nullptr;
+    };
+
+    const size_t depth;
+    const TraceReader* reader = nullptr;
+    std::vector<size_t> plan;
+    std::vector<Slot> slots;
+    size_t produced = 0;
+    size_t taken = 0;
+    bool stopping = false;
+    //failure to decode a block, rethrown when the block is taken
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable producedCond;
+    std::condition_variable takenCond;
+    std::thread worker;
+
+    double stallTime = 0;
+
+    void run();
+
+public:
+    BlockPrefetcher(size_t depth);
+    ~BlockPrefetcher();
+    void start(const TraceReader& reader, const std::vector<size_t>& plan);
+    void stop();
+    //returns events of the next block of the plan, waits if it isn't loaded yet.
+    //Rethrows the error if the block couldn't be decoded
+    Event* take(size_t block);
+    //seconds the consumer spent waiting for blocks
+    double getStallTime() const;
+};
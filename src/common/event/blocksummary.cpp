@@ -0,0 +1,182 @@
+#include <algorithm>
+#include "blocksummary.h"
+#include "common/utils.h"
+
+namespace trace
+{
+    static void bloomBits(int varId, uint32_t bits[3])
+    {
+        uint64_t h = (uint64_t)(uint32_t)varId * 0x9e3779b97f4a7c15ULL;
+        const uint32_t mask = BlockSummary::BloomWords * 64 - 1;
+        bits[0] = h & mask;
+        bits[1] = (h >> 21) & mask;
+        bits[2] = (h >> 42) & mask;
+    }
+
+    void BlockSummary::clear()
+    {
+        *this = BlockSummary();
+    }
+
+    void BlockSummary::addCallStacks(const CallStackGlobal& callStackGlobal)
+    {
+        for (size_t i = 0; i < callStackGlobal.callStacks.size(); i++)
+        {
+            for (auto& call: callStackGlobal.callStacks[i].calls)
+            {
+                callStacks.push_back(FrameSnapshot{(uint32_t)i, call.funcInfo->id, (uint64_t)call.frameBase});
+                routines.push_back(call.funcInfo->id);
+            }
+        }
+    }
+
+    void BlockSummary::add(const Event& e)
+    {
+        eventCount++;
+        uint64_t t = e.getTime();
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+
+        uint32_t threadId = e.getThreadId();
+        if (threadId < ThreadWords * 64)
+        {
+            threads[threadId / 64] |= 1ULL << (threadId % 64);
+        }
+        else
+        {
+            //can't be represented, so match any thread
+            std::fill(threads, threads + ThreadWords, ~0ULL);
+        }
+
+        switch (e.type)
+        {
+            case EventType::Call:
+            case EventType::Ret:
+                routines.push_back(e.routineEvent.routineId);
+                break;
+            case EventType::Read:
+            case EventType::Write:
+            case EventType::Alloc:
+            case EventType::Free:
+                addVar(e.memoryEvent.varId);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void BlockSummary::addVar(int varId)
+    {
+        uint32_t bits[3];
+        bloomBits(varId, bits);
+        for (auto b: bits)
+        {
+            varBloom[b / 64] |= 1ULL << (b % 64);
+        }
+    }
+
+    void BlockSummary::finish()
+    {
+        std::sort(routines.begin(), routines.end());
+        routines.erase(std::unique(routines.begin(), routines.end()), routines.end());
+    }
+
+    void BlockSummary::restoreCallStacks(CallStackGlobal& callStackGlobal,
+                                         const dbginfo::DebugContext& dbgContext, int threadId) const
+    {
+        if (threadId < 0)
+        {
+            callStackGlobal.clear();
+        }
+        else
+        {
+            callStackGlobal.getCallStack(threadId).clear();
+        }
+        for (auto& frame: callStacks)
+        {
+            auto* funcInfo = dbgContext.findFuncById(frame.funcId);
+            if (funcInfo && (threadId < 0 || (int)frame.threadId == threadId))
+            {
+                callStackGlobal.getCalls(frame.threadId).push_back(FuncCall(funcInfo, (void*)frame.frameBase));
+            }
+        }
+    }
+
+    bool BlockSummary::hasThread(uint32_t threadId) const
+    {
+        if (threadId >= ThreadWords * 64)
+        {
+            return threads[ThreadWords - 1] == ~0ULL;
+        }
+        return threads[threadId / 64] & (1ULL << (threadId % 64));
+    }
+
+    int BlockSummary::getMaxThreadId() const
+    {
+        for (int i = ThreadWords * 64 - 1; i >= 0; i--)
+        {
+            if (hasThread(i))
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    bool BlockSummary::hasRoutine(int routineId) const
+    {
+        return std::binary_search(routines.begin(), routines.end(), routineId);
+    }
+
+    bool BlockSummary::mayHaveVar(int varId) const
+    {
+        uint32_t bits[3];
+        bloomBits(varId, bits);
+        for (auto b: bits)
+        {
+            if (!(varBloom[b / 64] & (1ULL << (b % 64))))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void BlockSummary::save(std::ostream& out) const
+    {
+        utils::save(eventCount, out);
+        utils::save(minT, out);
+        utils::save(maxT, out);
+        utils::save(threads, out);
+        utils::save(varBloom, out);
+        utils::save(routines.size(), out);
+        for (auto r: routines)
+        {
+            utils::save(r, out);
+        }
+        utils::save(callStacks.size(), out);
+        for (auto& frame: callStacks)
+        {
+            utils::save(frame, out);
+        }
+    }
+
+    void BlockSummary::load(std::istream& in)
+    {
+        eventCount = utils::load<uint64_t>(in);
+        minT = utils::load<uint64_t>(in);
+        maxT = utils::load<uint64_t>(in);
+        in.read((char*)threads, sizeof(threads));
+        in.read((char*)varBloom, sizeof(varBloom));
+        routines.resize(utils::load<size_t>(in));
+        for (auto& r: routines)
+        {
+            r = utils::load<int>(in);
+        }
+        callStacks.resize(utils::load<size_t>(in));
+        for (auto& frame: callStacks)
+        {
+            frame = utils::load<FrameSnapshot>(in);
+        }
+    }
+} //namespace trace
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include "callstack.h"
+#include "event.h"
+
+namespace trace
+{
+    struct FrameSnapshot
+    {
+        uint32_t threadId;
+        int funcId;
+        uint64_t frameBase;
+    };
+
+    //Per block statistics stored in the trace footer.
+    //Lets readers skip blocks which can't contain events of interest
+    struct BlockSummary
+    {
+        static const int ThreadWords = 4;
+        static const int BloomWords = 16;
+
+        uint64_t eventCount = 0;
+        uint64_t minT = UINT64_MAX;
+        uint64_t maxT = 0;
+        uint64_t threads[ThreadWords] = {};
+        uint64_t varBloom[BloomWords] = {};
+        //routines with Call/Ret events in the block and routines on the call stacks at block start
+        std::vector<int> routines;
+        //call stacks of all threads at block start, bottom to top
+        std::vector<FrameSnapshot> callStacks;
+
+        void clear();
+        void addCallStacks(const CallStackGlobal& callStackGlobal);
+        void add(const Event& e);
+        void addVar(int varId);
+        //sorts and dedups routines, should be called once all events are added
+        void finish();
+        //threadId limits restoring to the stack of one thread, e.g. for a block of a per-thread shard
+        void restoreCallStacks(CallStackGlobal& callStackGlobal, const dbginfo::DebugContext& dbgContext,
+                               int threadId = -1) const;
+
+        bool hasThread(uint32_t threadId) const;
+        int getMaxThreadId() const;
+        bool hasRoutine(int routineId) const;
+        bool mayHaveVar(int varId) const;
+
+        void save(std::ostream& out) const;
+        void load(std::istream& in);
+    };
+} //namespace trace
@@ -1,9 +1,14 @@
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 #include "common/utils.h"
 #include "event.h"
 #include "eventmanager.h"
 
+static_assert(sizeof(Event) == 24, "Event layout changed");
+
+const uint64_t Event::startTime = utils::rdtsc();
+
 std::string to_string(EventType type)
 {
     switch (type)
@@ -26,13 +31,33 @@ std::string to_string(EventType type)
    return "Unknown EventType: " + std::to_string((int)type);
 }
 
+static const int ADDR_BITS = 48;
+static const uint64_t ADDR_MASK = (1ull << ADDR_BITS) - 1;
+
+void MemoryEvent::setAlloc(void* allocAddr, uint64_t size)
+{
+    assert(((uint64_t)allocAddr & ~ADDR_MASK) == 0);
+    assert((size >> 32) < (1ull << (64 - ADDR_BITS)));
+    addr = (void*)((uint64_t)allocAddr | ((size >> 32) << ADDR_BITS));
+    allocSizeLow = (uint32_t)size;
+}
+
+void* MemoryEvent::getAddr() const
+{
+    return (void*)((uint64_t)addr & ADDR_MASK);
+}
+
+uint64_t MemoryEvent::getAllocSize() const
+{
+    return (((uint64_t)addr >> ADDR_BITS) << 32) | allocSizeLow;
+}
+
 std::string MemoryEvent::str(const EventManager& eventManager) const
 {
     std::ostringstream oss;
     auto* varInfo = eventManager.getDebugContext().findVarById(varId);
     oss << "var: " << (varInfo ? varInfo->name : std::string("nullptr")) << " [" << varId << "]"
-        << "; thread: " << threadId << "; addr: " << addr
-        << "; size: " << size << "; inst: " << (void*)instAddr << "; t: " << t;
+        << "; addr: " << getAddr();
     return oss.str();
 }
 
@@ -44,43 +69,49 @@ std::string RoutineEvent::str(const EventManager& eventManager) const
     {
         oss << funcInfo->name << "; ";
     }
-    oss << "thread: " << threadId << "; inst: " << (void*)instAddr << "; t: " << t;
+    oss << "sp: " << stackPointerRegister;
     return oss.str();
 }
 
-Event::Event(EventType type, uint32_t threadId, void* addr, size_t size, uint64_t instAddr) :
+Event::Event(EventType type, uint32_t threadId, void* addr, size_t size, uint32_t instId) :
+    t(now()),
+    threadId(threadId),
     type(type)
 {
+    assert(threadId < (uint32_t)MAX_THREADS);
     switch (type)
     {
         case EventType::Read:
         case EventType::Write:
+            memoryEvent.addr = addr;
+            memoryEvent.access.size = std::min<size_t>(size, UINT8_MAX);
+            memoryEvent.access.instId = instId;
+            memoryEvent.varId = -1;
+            break;
         case EventType::Alloc:
         case EventType::Free:
-            memoryEvent.t = utils::rdtsc();
-            memoryEvent.threadId = threadId;
-            memoryEvent.addr = addr;
-            memoryEvent.size = size;
-            memoryEvent.instAddr = instAddr;
+            memoryEvent.setAlloc(addr, size);
+            memoryEvent.varId = -1;
             break;
         default:
             assert(false);
     }
 }
 
-Event::Event(EventType type, uint32_t threadId, int routineId, void* stackPointerRegister, uint64_t instAddr) :
+Event::Event(EventType type, uint32_t threadId, int routineId, void* stackPointerRegister, uint32_t instId) :
+    t(now()),
+    threadId(threadId),
     type(type)
 {
+    assert(threadId < (uint32_t)MAX_THREADS);
     switch (type)
     {
         case EventType::CallInst:
         case EventType::Call:
         case EventType::Ret:
-            routineEvent.t = utils::rdtsc();
-            routineEvent.threadId = threadId;
             routineEvent.routineId = routineId;
             routineEvent.stackPointerRegister = stackPointerRegister;
-            routineEvent.instAddr = instAddr;
+            routineEvent.instId = instId;
             break;
         default:
             assert(false);
@@ -97,13 +128,14 @@ std::string Event::str(const EventManager& eventManager) const
         case EventType::Write:
         case EventType::Alloc:
         case EventType::Free:
-            oss << memoryEvent.str(eventManager);
+            oss << memoryEvent.str(eventManager) << "; size: " << getSize() << "; ";
             break;
+        case EventType::CallInst:
         case EventType::Call:
         case EventType::Ret:
-            oss << routineEvent.str(eventManager);
+            oss << routineEvent.str(eventManager) << "; ";
             break;
     }
-    oss << "]";
+    oss << "thread: " << threadId << "; inst: " << getInstId() << "; t: " << t << "]";
     return oss.str();
 }
@@ -5,7 +5,7 @@
 #include "access.h"
 #include "common/utils.h"
 
-enum class EventType
+enum class EventType : uint8_t
 {
     CallInst,
     Call,
@@ -20,63 +20,109 @@ std::string to_string(EventType type);
 
 struct EventManager;
 
+//size of larger accesses (e.g. xsave) is clamped
+struct MemoryAccess
+{
+    uint32_t size : 8;
+    //id in the instruction table of DebugContext
+    uint32_t instId : 24;
+};
+
 struct MemoryEvent
 {
-    uint64_t t;
-    uint32_t threadId;
+    //user space addresses fit 48 bits, Alloc keeps the high bits of the size above them
     void* addr;
-    size_t size;
-    uint64_t instAddr;
+    union
+    {
+        //Read, Write
+        MemoryAccess access;
+        //Alloc, Free: there is no instruction, low bits of the size
+        uint32_t allocSizeLow;
+    };
     int varId;
 
+    void setAlloc(void* allocAddr, uint64_t size);
+    void* getAddr() const;
+    uint64_t getAllocSize() const;
     std::string str(const EventManager& eventManager) const;
 };
 
 struct RoutineEvent
 {
-    uint64_t t;
-    uint32_t threadId;
-    int routineId;
     void* stackPointerRegister;
-    uint64_t instAddr;
+    uint32_t instId;
+    int routineId;
 
     std::string str(const EventManager& eventManager) const;
 };
 
+//Packed to 24 bytes: blocks of events are the bulk of the memory of the tool and the queries
 struct Event
 {
-    EventType type;
+    //cycles since the process started, 52 bits last for more than 10 days at 4 GHz
+    uint64_t t : 52;
+    //below MAX_THREADS
+    uint64_t threadId : 8;
+    EventType type : 4;
     union
     {
         MemoryEvent memoryEvent;
         RoutineEvent routineEvent;
     };
 
+    //timestamps count from the start of the process to fit t
+    static const uint64_t startTime;
+    static uint64_t now()
+    {
+        return utils::rdtsc() - startTime;
+    }
+
     Event() = default;
-    Event(EventType type, uint32_t threadId, void* addr, size_t size = 0, uint64_t instAddr = 0);
-    Event(EventType type, uint32_t threadId, int routineId, void* stackPointerRegister, uint64_t instAddr = 0);
+    Event(EventType type, uint32_t threadId, void* addr, size_t size = 0, uint32_t instId = 0);
+    Event(EventType type, uint32_t threadId, int routineId, void* stackPointerRegister, uint32_t instId = 0);
     std::string str(const EventManager& eventManager) const;
     Access toAccess() const
     {
         assert(type == EventType::Read || type == EventType::Write);
         return Access((byte*)memoryEvent.addr,
-                      memoryEvent.size,
+                      memoryEvent.access.size,
                       type == EventType::Read ? AccessType::Read : AccessType::Write);
     }
-    uint32_t getThreadId() const
+    size_t getSize() const
     {
         switch (type)
         {
-            case EventType::CallInst:
-            case EventType::Call:
-            case EventType::Ret:
-                return routineEvent.threadId;
             case EventType::Read:
             case EventType::Write:
+                return memoryEvent.access.size;
             case EventType::Alloc:
             case EventType::Free:
-                return memoryEvent.threadId;
+                return memoryEvent.getAllocSize();
+            default:
+                return 0;
         }
-        return -1;
+    }
+    uint32_t getInstId() const
+    {
+        switch (type)
+        {
+            case EventType::Read:
+            case EventType::Write:
+                return memoryEvent.access.instId;
+            case EventType::CallInst:
+            case EventType::Call:
+            case EventType::Ret:
+                return routineEvent.instId;
+            default:
+                return 0;
+        }
+    }
+    uint32_t getThreadId() const
+    {
+        return threadId;
+    }
+    uint64_t getTime() const
+    {
+        return t;
     }
 };
@@ -1,3 +1,168 @@
+#include <iostream>
 #include "eventmanager.h"
 
-const int EventManager::EVENT_CHUNK_SIZE = 1 << 23;
+void EventManager::openStreams()
+{
+    if (shardThreads.empty())
+    {
+        streams.emplace_back(eventPath, -1);
+    }
+    for (int threadId: shardThreads)
+    {
+        streams.emplace_back(shardPath(eventPath, threadId), threadId);
+    }
+    uint64_t total = 0;
+    for (auto& stream: streams)
+    {
+        bool opened = stream.open(dbgContext);
+        assert(opened);
+        total += stream.reader.getTotalEvents();
+    }
+    assert(total >= totalEvents);
+}
+
+void EventManager::reset()
+{
+    callStackGlobal.clear();
+    mergeHeap.clear();
+    pendingStreams.clear();
+    currentStream = NO_STREAM;
+    if (eventPath.empty())
+    {
+        return;
+    }
+    if (streams.empty())
+    {
+        openStreams();
+    }
+    for (auto& stream: streams)
+    {
+        stream.rewind(writeBack);
+    }
+    if (shardThreads.empty())
+    {
+        currentStream = 0;
+    }
+    started = false;
+}
+
+void EventManager::start()
+{
+    started = true;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        //write back has to see every event to annotate it
+        if (writeBack || !threadFilter || streams[i].threadId < 0 || threadFilter(streams[i].threadId))
+        {
+            planBlocks(streams[i]);
+            streams[i].startReading(readAheadDepth);
+            pendingStreams.push_back(i);
+        }
+    }
+}
+
+void EventManager::planBlocks(TraceStream& stream)
+{
+    auto& reader = stream.reader;
+    for (size_t i = 0; i < reader.getBlockCount(); i++)
+    {
+        if (writeBack || !blockFilter || !reader.hasSummaries() || blockFilter(reader.getSummary(i)))
+        {
+            stream.plan.push_back(i);
+        }
+        else
+        {
+            totalThreads = std::max(totalThreads, reader.getSummary(i).getMaxThreadId() + 1);
+        }
+    }
+}
+
+bool EventManager::advance(TraceStream& stream)
+{
+    if (!started)
+    {
+        start();
+    }
+    while (!stream.hasEvent())
+    {
+        if (!stream.hasNextBlock())
+        {
+            return false;
+        }
+        stream.loadNextBlock();
+        if (stream.callStacksStale)
+        {
+            stream.reader.getSummary(stream.nextBlock - 1).restoreCallStacks(callStackGlobal, dbgContext,
+                                                                              stream.threadId);
+            stream.callStacksStale = false;
+        }
+    }
+    return true;
+}
+
+bool EventManager::hasNextMerged()
+{
+    if (currentStream != NO_STREAM)
+    {
+        return true;
+    }
+    if (!started)
+    {
+        start();
+    }
+    for (size_t i: pendingStreams)
+    {
+        if (advance(streams[i]))
+        {
+            mergeHeap.push_back(std::make_pair(streams[i].current().getTime(), i));
+            std::push_heap(mergeHeap.begin(), mergeHeap.end(), std::greater<std::pair<uint64_t, size_t>>());
+        }
+    }
+    pendingStreams.clear();
+    if (mergeHeap.empty())
+    {
+        return false;
+    }
+    currentStream = mergeHeap.front().second;
+    return true;
+}
+
+void EventManager::setReadAhead(size_t depth)
+{
+    readAheadDepth = depth;
+    reset();
+}
+
+double EventManager::getStallTime() const
+{
+    double stallTime = 0;
+    for (auto& stream: streams)
+    {
+        stallTime += stream.getStallTime();
+    }
+    return stallTime;
+}
+
+void EventManager::enableWriteBack()
+{
+    writeBack = true;
+    reset();
+}
+
+void EventManager::dump()
+{
+    if (!writeBack)
+    {
+        return;
+    }
+    if (!started)
+    {
+        start();
+    }
+    for (auto& stream: streams)
+    {
+        stream.finishWriteBack();
+    }
+    writeBack = false;
+    reset();
+}
@@ -2,47 +2,87 @@
 #include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
 #include <vector>
 #include "callstack.h"
 #include "config.h"
 #include "debuginfo/debugcontext.h"
 #include "event.h"
+#include "region.h"
+#include "tracestream.h"
 
 class EventManager
 {
-    static const int EVENT_CHUNK_SIZE;
+    static const size_t NO_STREAM = SIZE_MAX;
     CallStackGlobal callStackGlobal;
     const dbginfo::DebugContext& dbgContext;
     std::string eventPath;
-    int totalEvents;
-    int iterIndex = 0;
+    uint64_t totalEvents;
     int totalThreads = 0;
-    std::vector<Event> preloadEvents;
+    //threads with own shard files, empty if the trace is a single file
+    std::vector<int> shardThreads;
+    //windows recorded with the ROI API, in order of their beginning
+    std::vector<Region> regions;
+
+    //shards are merged into a single stream ordered by event time
+    std::vector<TraceStream> streams;
+    std::vector<std::pair<uint64_t, size_t>> mergeHeap;
+    std::vector<size_t> pendingStreams;
+    size_t currentStream = NO_STREAM;
+
+    //blocks whose summary is rejected by the filter are skipped without reading
+    std::function<bool(const trace::BlockSummary&)> blockFilter;
+    //shards of rejected threads are not read at all
+    std::function<bool(int)> threadFilter;
+
+    //the trace is immutable, resolved varIds are kept in the annotation sidecars
+    //and joined block by block while reading
+    bool writeBack = false;
+
+    //blocks are decoded this many blocks ahead by a thread per stream, 0 reads synchronously
+    size_t readAheadDepth = 0;
+    //blocks to read are planned when the iteration starts, so filters set after reset() apply
+    bool started = false;
+
+    void openStreams();
+    void start();
+    void planBlocks(TraceStream& stream);
+    bool advance(TraceStream& stream);
+    bool hasNextMerged();
 
 public:
     EventManager(const dbginfo::DebugContext& dbgContext, const std::string& eventPath = std::string(),
-                 int totalEvents = 0):
+                 uint64_t totalEvents = 0, const std::vector<int>& shardThreads = std::vector<int>()):
         callStackGlobal(MAX_THREADS),
         dbgContext(dbgContext),
         eventPath(eventPath),
-        totalEvents(totalEvents)
+        totalEvents(totalEvents),
+        shardThreads(shardThreads)
     {
         reset();
     }
 
-    void reset()
+    EventManager(EventManager&& em) = default;
+
+    static std::string shardPath(const std::string& eventPath, int threadId)
     {
-        iterIndex = 0;
-        preloadEvents.resize(EVENT_CHUNK_SIZE);
-        callStackGlobal.clear();
+        return eventPath + "." + std::to_string(threadId);
     }
 
+    void reset();
+
     bool hasNext()
     {
-        return iterIndex < totalEvents;
+        if (shardThreads.empty() && !streams.empty())
+        {
+            return streams[0].hasEvent() || advance(streams[0]);
+        }
+        return hasNextMerged();
     }
 
-    size_t size() const
+    uint64_t size() const
     {
         return totalEvents;
     }
@@ -50,63 +90,52 @@ public:
     Event& next()
     {
         assert(hasNext());
-        int mod = iterIndex % EVENT_CHUNK_SIZE;
-        if (mod == 0)
-        {
-            dump();
-            size_t eventCount = std::min(EVENT_CHUNK_SIZE, totalEvents - iterIndex);
-            std::ifstream in(eventPath, std::ios::binary);
-            in.seekg(iterIndex * sizeof(Event), in.beg);
-            in.read((char*)&preloadEvents[0], eventCount * sizeof(Event));
-        }
-        iterIndex++;
-        Event& e = preloadEvents[mod];
-        switch (e.type)
+        TraceStream& stream = streams[currentStream];
+        Event& e = stream.blockEvents[stream.blockPos++];
+        if (!shardThreads.empty())
         {
-            case EventType::Call:
-            case EventType::Ret:
-            {
-                totalThreads = std::max(totalThreads - 1, (int)e.routineEvent.threadId) + 1;
-                auto* funcInfo = dbgContext.findFuncById(e.routineEvent.routineId);
-                if (!funcInfo)
-                {
-                    break;
-                }
-
-                void* frameBase = (char*)e.routineEvent.stackPointerRegister + funcInfo->stackOffset;
-                FuncCall funcCall(funcInfo, frameBase);
-                if (e.type == EventType::Call)
-                {
-                    callStackGlobal.push(e.routineEvent.threadId, funcCall);
-                }
-                else
-                {
-                    callStackGlobal.pop(e.routineEvent.threadId, funcCall);
-                }
-                break;
-            }
-            //MemoryEvent
-            default:
-                totalThreads = std::max(totalThreads - 1, (int)e.memoryEvent.threadId) + 1;
-                break;
+            //the stream is advanced on the next call, the returned event must stay valid until then
+            std::pop_heap(mergeHeap.begin(), mergeHeap.end(), std::greater<std::pair<uint64_t, size_t>>());
+            mergeHeap.pop_back();
+            pendingStreams.push_back(currentStream);
+            currentStream = NO_STREAM;
         }
+        totalThreads = std::max(totalThreads - 1, (int)e.getThreadId()) + 1;
+        callStackGlobal.handleEvent(e, dbgContext);
         return e;
     }
 
-    void dump()
+    //filter is consulted for every block with a summary when the iteration starts, write back disables it
+    void setBlockFilter(const std::function<bool(const trace::BlockSummary&)>& filter)
     {
-        int curIndex = iterIndex - 1;
-        if (curIndex <= 0 || curIndex >= totalEvents)
-        {
-            return;
-        }
-        int begIndex = (curIndex / EVENT_CHUNK_SIZE ) * EVENT_CHUNK_SIZE;
-        int eventCount = std::min(EVENT_CHUNK_SIZE, totalEvents - begIndex);
-        std::fstream out(eventPath, std::ios::binary | std::ios::in | std::ios::out);
-        out.seekp(begIndex * sizeof(Event), out.beg);
-        out.write((char*)&preloadEvents[0], eventCount * sizeof(Event));
+        blockFilter = filter;
+    }
+
+    //only sharded traces can drop threads without reading their events
+    void setThreadFilter(const std::function<bool(int)>& filter)
+    {
+        threadFilter = filter;
     }
 
+    //sampling of the recorded accesses, shards of a trace share it
+    trace::Sampling getSampling() const
+    {
+        return streams.empty() ? trace::Sampling() : streams[0].reader.getSampling();
+    }
+
+    void setReadAhead(size_t depth);
+    //seconds the iteration waited for blocks, high values mean the query is I/O bound
+    double getStallTime() const;
+
+    bool isSharded() const
+    {
+        return !shardThreads.empty();
+    }
+
+    //makes varIds of the events returned by next() persistent, dump() writes them to the sidecars
+    void enableWriteBack();
+    void dump();
+
     const dbginfo::DebugContext& getDebugContext() const
     {
         return dbgContext;
@@ -117,6 +146,39 @@ public:
         return totalThreads;
     }
 
+    void setRegions(const std::vector<Region>& regions)
+    {
+        this->regions = regions;
+    }
+
+    const std::vector<Region>& getRegions() const
+    {
+        return regions;
+    }
+
+    //innermost region of the thread containing the time, nullptr outside regions
+    const Region* findRegion(int threadId, uint64_t t) const
+    {
+        const Region* found = nullptr;
+        for (auto& region: regions)
+        {
+            if (region.begin > t)
+            {
+                break;
+            }
+            if (region.contains(threadId, t))
+            {
+                found = &region;
+            }
+        }
+        return found;
+    }
+
+    const CallStackGlobal& getCallStacks() const
+    {
+        return callStackGlobal;
+    }
+
     const dbginfo::FuncInfo* topFuncInfo(int threadId) const
     {
         if (callStackGlobal.empty(threadId))
@@ -131,14 +193,55 @@ public:
         utils::save(eventPath, out);
         utils::save(totalEvents, out);
         utils::save(totalThreads, out);
+        utils::save(shardThreads.size(), out);
+        for (int threadId: shardThreads)
+        {
+            utils::save(threadId, out);
+        }
+        utils::save(regions.size(), out);
+        for (auto& region: regions)
+        {
+            utils::save(region.name, out);
+            utils::save(region.threadId, out);
+            utils::save(region.begin, out);
+            utils::save(region.end, out);
+        }
     }
 
-    void load(std::ifstream& in)
+    //relative trace path is resolved against baseDir, the directory the trace was recorded in
+    void load(std::ifstream& in, const std::string& baseDir = std::string())
     {
         eventPath = utils::load<std::string>(in);
-        totalEvents = utils::load<int>(in);
+        if (!baseDir.empty() && !eventPath.empty() && eventPath[0] != '/')
+        {
+            eventPath = baseDir + "/" + eventPath;
+        }
+        totalEvents = utils::load<uint64_t>(in);
         totalThreads = utils::load<int>(in);
-        std::cout << "[INFO] EventManager loaded: " << totalEvents << " events" << std::endl;
+        shardThreads.resize(utils::load<size_t>(in));
+        for (int& threadId: shardThreads)
+        {
+            threadId = utils::load<int>(in);
+        }
+        regions.resize(utils::load<size_t>(in));
+        for (auto& region: regions)
+        {
+            region.name = utils::load<std::string>(in);
+            region.threadId = utils::load<int>(in);
+            region.begin = utils::load<uint64_t>(in);
+            region.end = utils::load<uint64_t>(in);
+        }
+        std::cout << "[INFO] EventManager loaded: " << totalEvents << " events";
+        if (!shardThreads.empty())
+        {
+            std::cout << " in " << shardThreads.size() << " shards";
+        }
+        if (!regions.empty())
+        {
+            std::cout << ", " << regions.size() << " regions";
+        }
+        std::cout << std::endl;
+        streams.clear();
         reset();
     }
 };
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include "profile.h"
+#include "common/utils.h"
+
+//------------------------------------------------------------------------------
+//Profile::Counts
+//------------------------------------------------------------------------------
+
+void Profile::Counts::add(const Event& e)
+{
+    if (e.type == EventType::Read)
+    {
+        reads++;
+    }
+    else
+    {
+        writes++;
+    }
+    bytes += e.memoryEvent.access.size;
+}
+
+void Profile::Counts::add(const Counts& counts)
+{
+    reads += counts.reads;
+    writes += counts.writes;
+    bytes += counts.bytes;
+}
+
+//------------------------------------------------------------------------------
+//Profile
+//------------------------------------------------------------------------------
+
+template <class TKey>
+static void saveCounts(const std::map<TKey, Profile::Counts>& counts, std::ostream& out)
+{
+    utils::save(counts.size(), out);
+    for (auto& e: counts)
+    {
+        utils::save(e.first, out);
+        utils::save(e.second, out);
+    }
+}
+
+template <class TKey>
+static void loadCounts(std::map<TKey, Profile::Counts>& counts, std::istream& in)
+{
+    counts.clear();
+    size_t size = utils::load<size_t>(in);
+    for (size_t i = 0; i < size; i++)
+    {
+        TKey key = utils::load<TKey>(in);
+        counts[key] = utils::load<Profile::Counts>(in);
+    }
+}
+
+template <class TKey>
+static void mergeCounts(std::map<TKey, Profile::Counts>& counts, const std::map<TKey, Profile::Counts>& other)
+{
+    for (auto& e: other)
+    {
+        counts[e.first].add(e.second);
+    }
+}
+
+void Profile::setSampling(const trace::Sampling& sampling)
+{
+    this->sampling = sampling;
+}
+
+const trace::Sampling& Profile::getSampling() const
+{
+    return sampling;
+}
+
+void Profile::addAccess(const Event& e, int funcId)
+{
+    assert(e.type == EventType::Read || e.type == EventType::Write);
+    varCounts[VarThread(e.memoryEvent.varId, e.getThreadId())].add(e);
+    funcCounts[funcId].add(e);
+    instCounts[e.memoryEvent.access.instId].add(e);
+}
+
+void Profile::merge(const Profile& profile)
+{
+    mergeCounts(varCounts, profile.varCounts);
+    mergeCounts(funcCounts, profile.funcCounts);
+    mergeCounts(instCounts, profile.instCounts);
+}
+
+bool Profile::isEmpty() const
+{
+    return instCounts.empty();
+}
+
+const std::map<Profile::VarThread, Profile::Counts>& Profile::getVarCounts() const
+{
+    return varCounts;
+}
+
+const std::map<int, Profile::Counts>& Profile::getFuncCounts() const
+{
+    return funcCounts;
+}
+
+const std::map<uint32_t, Profile::Counts>& Profile::getInstCounts() const
+{
+    return instCounts;
+}
+
+std::vector<std::pair<uint32_t, Profile::Counts>> Profile::getHotInsts(size_t count) const
+{
+    std::vector<std::pair<uint32_t, Counts>> insts(instCounts.begin(), instCounts.end());
+    count = std::min(count, insts.size());
+    std::partial_sort(insts.begin(), insts.begin() + count, insts.end(),
+                      [](const std::pair<uint32_t, Counts>& a, const std::pair<uint32_t, Counts>& b)
+                      {
+                          return a.second.accesses() > b.second.accesses();
+                      });
+    insts.resize(count);
+    return insts;
+}
+
+void Profile::save(std::ostream& out) const
+{
+    utils::save(sampling, out);
+    saveCounts(varCounts, out);
+    saveCounts(funcCounts, out);
+    saveCounts(instCounts, out);
+}
+
+void Profile::load(std::istream& in)
+{
+    sampling = utils::load<trace::Sampling>(in);
+    loadCounts(varCounts, in);
+    loadCounts(funcCounts, in);
+    loadCounts(instCounts, in);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+#include "event.h"
+#include "traceformat.h"
+
+//Access counts aggregated during capture, written instead of a trace in the profile mode of the tool
+class Profile
+{
+public:
+    struct Counts
+    {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t bytes = 0;
+
+        void add(const Event& e);
+        void add(const Counts& counts);
+        uint64_t accesses() const
+        {
+            return reads + writes;
+        }
+    };
+
+    //(varId, threadId)
+    typedef std::pair<int, int> VarThread;
+
+private:
+    trace::Sampling sampling;
+    //accesses not resolved to a variable are counted under varId -1
+    std::map<VarThread, Counts> varCounts;
+    //by the innermost routine known to the debug info, -1 outside of them
+    std::map<int, Counts> funcCounts;
+    std::map<uint32_t, Counts> instCounts;
+
+public:
+    void setSampling(const trace::Sampling& sampling);
+    const trace::Sampling& getSampling() const;
+    void addAccess(const Event& e, int funcId);
+    void merge(const Profile& profile);
+    bool isEmpty() const;
+
+    const std::map<VarThread, Counts>& getVarCounts() const;
+    const std::map<int, Counts>& getFuncCounts() const;
+    const std::map<uint32_t, Counts>& getInstCounts() const;
+    //at most count instructions, most executed first
+    std::vector<std::pair<uint32_t, Counts>> getHotInsts(size_t count) const;
+
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+};
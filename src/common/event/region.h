@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+//window of a thread between its bininst_roi_begin(name) and bininst_roi_end()
+struct Region
+{
+    std::string name;
+    int threadId;
+    uint64_t begin;
+    //UINT64_MAX if the region wasn't closed before the end of the run
+    uint64_t end;
+
+    Region(const std::string& name = std::string(), int threadId = 0, uint64_t begin = 0, uint64_t end = UINT64_MAX):
+        name(name),
+        threadId(threadId),
+        begin(begin),
+        end(end)
+    {
+    }
+
+    bool contains(int threadId, uint64_t t) const
+    {
+        return this->threadId == threadId && begin <= t && t < end;
+    }
+};
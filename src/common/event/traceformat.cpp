@@ -0,0 +1,193 @@
+#include "config.h"
+#include "traceformat.h"
+
+namespace trace
+{
+    //------------------------------------------------------------------------------
+    //BlockEncoder
+    //------------------------------------------------------------------------------
+
+    void BlockEncoder::reset()
+    {
+        threads.clear();
+        instIds.clear();
+        lastThreadId = UINT32_MAX;
+    }
+
+    bool BlockEncoder::putInst(std::vector<uint8_t>& out, uint32_t instId)
+    {
+        auto ret = instIds.insert(std::make_pair(instId, (uint32_t)instIds.size()));
+        if (ret.second)
+        {
+            putVarint(out, instId);
+            return true;
+        }
+        putVarint(out, ret.first->second);
+        return false;
+    }
+
+    void BlockEncoder::encode(const Event& e, std::vector<uint8_t>& out)
+    {
+        size_t tagPos = out.size();
+        uint8_t tag = (uint8_t)e.type;
+        out.push_back(tag);
+
+        uint32_t threadId = e.getThreadId();
+        if (threadId == lastThreadId)
+        {
+            tag |= RecordSameThread;
+        }
+        else
+        {
+            putVarint(out, threadId);
+            lastThreadId = threadId;
+        }
+        if (threads.size() <= threadId)
+        {
+            threads.resize(threadId + 1);
+        }
+        auto& state = threads[threadId];
+        putVarint(out, zigzag(e.t - state.t));
+        state.t = e.t;
+
+        switch (e.type)
+        {
+            case EventType::Read:
+            case EventType::Write:
+            case EventType::Alloc:
+            case EventType::Free:
+            {
+                auto& me = e.memoryEvent;
+                putVarint(out, zigzag((uint64_t)me.getAddr() - state.addr));
+                putVarint(out, e.getSize());
+                if (putInst(out, e.getInstId()))
+                {
+                    tag |= RecordNewInst;
+                }
+                state.addr = (uint64_t)me.getAddr();
+                break;
+            }
+            case EventType::CallInst:
+            case EventType::Call:
+            case EventType::Ret:
+            {
+                auto& re = e.routineEvent;
+                putVarint(out, zigzag(re.routineId));
+                putVarint(out, zigzag((uint64_t)re.stackPointerRegister - state.stackPointer));
+                if (putInst(out, re.instId))
+                {
+                    tag |= RecordNewInst;
+                }
+                state.stackPointer = (uint64_t)re.stackPointerRegister;
+                break;
+            }
+        }
+        out[tagPos] = tag;
+    }
+
+    //------------------------------------------------------------------------------
+    //BlockDecoder
+    //------------------------------------------------------------------------------
+
+    void BlockDecoder::reset()
+    {
+        threads.clear();
+        insts.clear();
+        lastThreadId = UINT32_MAX;
+    }
+
+    uint32_t BlockDecoder::getInst(const uint8_t*& p, const uint8_t* end, uint8_t tag)
+    {
+        if (tag & RecordNewInst)
+        {
+            insts.push_back((uint32_t)getVarint(p, end));
+            return insts.back();
+        }
+        uint64_t i = getVarint(p, end);
+        if (i >= insts.size())
+        {
+            throw std::runtime_error("corrupt trace: instruction out of the table of the block");
+        }
+        return insts[i];
+    }
+
+    const uint8_t* BlockDecoder::decode(const uint8_t* p, const uint8_t* end, size_t eventCount, Event* events)
+    {
+        reset();
+        for (size_t i = 0; i < eventCount; i++)
+        {
+            Event& e = events[i];
+            if (p >= end)
+            {
+                throw std::runtime_error("corrupt trace: block holds fewer records than its header");
+            }
+            uint8_t tag = *p++;
+            if ((tag & RecordTypeMask) > (uint8_t)EventType::Free)
+            {
+                throw std::runtime_error("corrupt trace: unknown record type");
+            }
+            e.type = (EventType)(tag & RecordTypeMask);
+
+            uint32_t threadId = lastThreadId;
+            if (!(tag & RecordSameThread))
+            {
+                threadId = (uint32_t)getVarint(p, end);
+                lastThreadId = threadId;
+            }
+            if (threadId >= (uint32_t)MAX_THREADS)
+            {
+                throw std::runtime_error("corrupt trace: thread id out of range");
+            }
+            if (threads.size() <= threadId)
+            {
+                threads.resize(threadId + 1);
+            }
+            auto& state = threads[threadId];
+            e.threadId = threadId;
+            e.t = state.t += unzigzag(getVarint(p, end));
+
+            switch (e.type)
+            {
+                case EventType::Read:
+                case EventType::Write:
+                case EventType::Alloc:
+                case EventType::Free:
+                {
+                    auto& me = e.memoryEvent;
+                    state.addr += unzigzag(getVarint(p, end));
+                    uint64_t size = getVarint(p, end);
+                    uint32_t instId = getInst(p, end, tag);
+                    if (e.type == EventType::Read || e.type == EventType::Write)
+                    {
+                        me.addr = (void*)state.addr;
+                        me.access.size = size;
+                        me.access.instId = instId;
+                    }
+                    else
+                    {
+                        //Alloc keeps 48 bits of the address and of the size
+                        if ((state.addr | size) >> 48)
+                        {
+                            throw std::runtime_error("corrupt trace: allocation out of range");
+                        }
+                        me.setAlloc((void*)state.addr, size);
+                    }
+                    me.varId = -1;
+                    break;
+                }
+                case EventType::CallInst:
+                case EventType::Call:
+                case EventType::Ret:
+                {
+                    auto& re = e.routineEvent;
+                    re.routineId = (int)unzigzag(getVarint(p, end));
+                    state.stackPointer += unzigzag(getVarint(p, end));
+                    re.stackPointerRegister = (void*)state.stackPointer;
+                    re.instId = getInst(p, end, tag);
+                    break;
+                }
+            }
+        }
+        return p;
+    }
+} //namespace trace
@@ -0,0 +1,220 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "blockcodec.h"
+#include "event.h"
+
+//Trace file layout (v2):
+//  TraceHeader
+//  (BlockHeader payload)*
+//  index: (BlockIndexEntry BlockSummary)*
+//  IndexTrailer
+//Each block is encoded independently: per thread deltas and the instruction table
+//are reset at block boundaries so any block can be decoded without its predecessors.
+//Payload is optionally compressed as a whole, BlockHeader records the codec and the raw size.
+//The index is written on close, traces without it (e.g. the tool was killed) are scanned block by block.
+//Files without TraceHeader are raw arrays of the unpacked Event with instruction addresses (v1).
+//Instructions are ids in the instruction table of DebugContext (v3), v2 stored addresses.
+//TraceHeader records how memory accesses were sampled at capture (v4).
+//Memory records don't carry varId, it's resolved after the run and kept in the annotation sidecar
+//(see annotation.h). Readers accept v1 and the current version, v2 and v3 traces have to be recorded again.
+namespace trace
+{
+    const uint64_t TraceMagic = 0x32454341525442ULL; //"BTRACE2\0"
+    const uint32_t BlockMagic = 0x4b4c4254; //"TBLK"
+    const uint32_t IndexMagic = 0x58444954; //"TIDX"
+    const uint32_t TraceVersion = 4;
+
+    //memory accesses recorded at capture, other events are never sampled
+    struct Sampling
+    {
+        //bursts of burstLength accesses every burstPeriod accesses of a thread, 0 records all
+        uint32_t burstLength = 0;
+        uint32_t burstPeriod = 0;
+        //every instPeriod-th execution of each memory instruction, 0 records all
+        uint32_t instPeriod = 0;
+        uint32_t reserved = 0;
+
+        bool isEnabled() const
+        {
+            return burstPeriod > 0 || instPeriod > 0;
+        }
+
+        //expected fraction of the accesses that are recorded
+        double getFraction() const
+        {
+            double fraction = 1;
+            if (burstPeriod > 0)
+            {
+                fraction *= (double)burstLength / burstPeriod;
+            }
+            if (instPeriod > 0)
+            {
+                fraction /= instPeriod;
+            }
+            return fraction;
+        }
+    };
+
+    struct TraceHeader
+    {
+        uint64_t magic = TraceMagic;
+        uint32_t version = TraceVersion;
+        uint32_t flags = 0;
+        Sampling sampling;
+    };
+
+    struct BlockHeader
+    {
+        uint32_t magic = BlockMagic;
+        uint32_t eventCount = 0;
+        uint64_t payloadSize = 0;
+        uint64_t rawSize = 0;
+        Codec codec = Codec::None;
+        uint8_t level = 0;
+        uint8_t reserved[6] = {};
+    };
+
+    struct BlockIndexEntry
+    {
+        uint64_t offset = 0;
+        BlockHeader header;
+    };
+
+    struct IndexTrailer
+    {
+        uint64_t indexOffset = 0;
+        uint64_t blockCount = 0;
+        uint32_t magic = IndexMagic;
+        uint32_t reserved = 0;
+    };
+
+    //Event of v1 traces as it was laid out in memory, instAddr is translated through DebugContext
+    struct V1MemoryEvent
+    {
+        uint64_t t;
+        uint32_t threadId;
+        uint64_t addr;
+        uint64_t size;
+        uint64_t instAddr;
+        int32_t varId;
+    };
+
+    struct V1RoutineEvent
+    {
+        uint64_t t;
+        uint32_t threadId;
+        int32_t routineId;
+        uint64_t stackPointerRegister;
+        uint64_t instAddr;
+    };
+
+    struct V1Event
+    {
+        int32_t type;
+        union
+        {
+            V1MemoryEvent memoryEvent;
+            V1RoutineEvent routineEvent;
+        };
+    };
+
+    //tag and four or five varints of 64 bits
+    const uint64_t MinRecordSize = 1 + 4;
+    const uint64_t MaxRecordSize = 1 + 5 * 10;
+
+    //record tag layout: [0..3] EventType, [4] same thread as previous record, [5] new instruction
+    enum RecordFlags : uint8_t
+    {
+        RecordTypeMask = 0x0f,
+        RecordSameThread = 0x10,
+        RecordNewInst = 0x20
+    };
+
+    inline void putVarint(std::vector<uint8_t>& out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((uint8_t)v);
+    }
+
+    inline uint64_t getVarint(const uint8_t*& p)
+    {
+        uint64_t v = 0;
+        int shift = 0;
+        while (*p & 0x80)
+        {
+            v |= (uint64_t)(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        v |= (uint64_t)(*p++) << shift;
+        return v;
+    }
+
+    //for payloads read from disk, throws if the varint runs past end
+    inline uint64_t getVarint(const uint8_t*& p, const uint8_t* end)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+            {
+                return v;
+            }
+        }
+        throw std::runtime_error("corrupt trace: record runs past the end of its block");
+    }
+
+    inline uint64_t zigzag(int64_t v)
+    {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t v)
+    {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    struct ThreadDeltaState
+    {
+        uint64_t t = 0;
+        uint64_t addr = 0;
+        uint64_t stackPointer = 0;
+    };
+
+    class BlockEncoder
+    {
+        std::vector<ThreadDeltaState> threads;
+        std::unordered_map<uint32_t, uint32_t> instIds;
+        uint32_t lastThreadId = UINT32_MAX;
+
+        //returns true if instruction is seen first time in the block
+        bool putInst(std::vector<uint8_t>& out, uint32_t instId);
+
+    public:
+        void reset();
+        void encode(const Event& e, std::vector<uint8_t>& out);
+    };
+
+    class BlockDecoder
+    {
+        std::vector<ThreadDeltaState> threads;
+        std::vector<uint32_t> insts;
+        uint32_t lastThreadId = UINT32_MAX;
+
+        uint32_t getInst(const uint8_t*& p, const uint8_t* end, uint8_t tag);
+
+    public:
+        void reset();
+        //decodes eventCount records from payload and returns pointer past the last one,
+        //throws std::runtime_error if the records are corrupt
+        const uint8_t* decode(const uint8_t* payload, const uint8_t* end, size_t eventCount, Event* events);
+    };
+} //namespace trace
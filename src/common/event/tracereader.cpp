@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "config.h"
+#include "tracereader.h"
+
+static TraceBlock makeBlock(uint64_t offset, const trace::BlockHeader& header, uint64_t firstEvent)
+{
+    TraceBlock block;
+    block.offset = offset;
+    block.payloadSize = header.payloadSize;
+    block.rawSize = header.rawSize;
+    block.codec = header.codec;
+    block.level = header.level;
+    block.firstEvent = firstEvent;
+    block.eventCount = header.eventCount;
+    return block;
+}
+
+//v1 traces have no blocks, they are read in chunks of events
+static const uint32_t V1BlockEvents = 1 << 20;
+
+bool TraceReader::open(const std::string& path, const dbginfo::DebugContext* dbgCtxt)
+{
+    close();
+    if (!file.open(path))
+    {
+        return false;
+    }
+    trace::TraceHeader header;
+    bool hasHeader = file.size() >= sizeof(header);
+    if (hasHeader)
+    {
+        memcpy(&header, file.begin(), sizeof(header));
+        hasHeader = header.magic == trace::TraceMagic;
+    }
+    uint32_t fileVersion = hasHeader ? header.version : 1;
+    std::ostringstream error;
+    if (fileVersion != 1 && fileVersion != trace::TraceVersion)
+    {
+        error << path << ": unsupported trace version " << fileVersion << ", expected 1 or " << trace::TraceVersion;
+    }
+    else if (fileVersion == 1 && file.size() % sizeof(trace::V1Event) != 0)
+    {
+        error << path << ": not a trace, the size isn't a multiple of v1 events";
+    }
+    else if (fileVersion == 1 && !dbgCtxt)
+    {
+        error << path << ": v1 trace can't be read without the debug context";
+    }
+    if (!error.str().empty())
+    {
+        close();
+        throw std::runtime_error(error.str());
+    }
+    version = fileVersion;
+    this->dbgCtxt = dbgCtxt;
+    if (version == 1)
+    {
+        splitV1Blocks();
+    }
+    else
+    {
+        sampling = header.sampling;
+        if (!loadIndex())
+        {
+            scanBlocks();
+        }
+    }
+    file.adviseSequential();
+    return true;
+}
+
+void TraceReader::scanBlocks()
+{
+    uint64_t offset = sizeof(trace::TraceHeader);
+    uint64_t firstEvent = 0;
+    while (offset + sizeof(trace::BlockHeader) <= file.size())
+    {
+        trace::BlockHeader header;
+        memcpy(&header, file.begin() + offset, sizeof(header));
+        offset += sizeof(header);
+        //stop at truncated tail, e.g. if the tool was killed while writing
+        if (header.magic != trace::BlockMagic || header.payloadSize > file.size() - offset)
+        {
+            break;
+        }
+        blocks.push_back(makeBlock(offset, header, firstEvent));
+        offset += header.payloadSize;
+        firstEvent += header.eventCount;
+    }
+}
+
+bool TraceReader::loadIndex()
+{
+    trace::IndexTrailer trailer;
+    if (file.size() < sizeof(trace::TraceHeader) + sizeof(trailer))
+    {
+        return false;
+    }
+    size_t trailerOffset = file.size() - sizeof(trailer);
+    memcpy(&trailer, file.begin() + trailerOffset, sizeof(trailer));
+    if (trailer.magic != trace::IndexMagic || trailer.indexOffset > trailerOffset)
+    {
+        return false;
+    }
+    std::istringstream in(std::string(file.begin() + trailer.indexOffset, trailerOffset - trailer.indexOffset));
+    uint64_t firstEvent = 0;
+    for (uint64_t i = 0; i < trailer.blockCount; i++)
+    {
+        auto entry = utils::load<trace::BlockIndexEntry>(in);
+        trace::BlockSummary summary;
+        summary.load(in);
+        if (!in.good())
+        {
+            blocks.clear();
+            summaries.clear();
+            return false;
+        }
+        if (entry.offset > trailer.indexOffset || entry.header.payloadSize > trailer.indexOffset - entry.offset)
+        {
+            throw std::runtime_error("corrupt trace: block " + std::to_string(i) + " of the index is out of the file");
+        }
+        blocks.push_back(makeBlock(entry.offset, entry.header, firstEvent));
+        summaries.push_back(std::move(summary));
+        firstEvent += entry.header.eventCount;
+    }
+    return true;
+}
+
+void TraceReader::splitV1Blocks()
+{
+    uint64_t total = file.size() / sizeof(trace::V1Event);
+    for (uint64_t first = 0; first < total; first += V1BlockEvents)
+    {
+        trace::BlockHeader header;
+        header.eventCount = std::min<uint64_t>(V1BlockEvents, total - first);
+        header.payloadSize = header.rawSize = header.eventCount * sizeof(trace::V1Event);
+        blocks.push_back(makeBlock(first * sizeof(trace::V1Event), header, first));
+    }
+    if (total > 0)
+    {
+        trace::V1Event e;
+        memcpy(&e, file.begin(), sizeof(e));
+        v1StartTime = e.memoryEvent.t;
+    }
+}
+
+void TraceReader::decodeV1(const uint8_t* payload, uint32_t count, Event* events) const
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        trace::V1Event v1;
+        memcpy(&v1, payload + i * sizeof(v1), sizeof(v1));
+        //t and threadId lead both kinds of events
+        if (v1.memoryEvent.threadId >= (uint32_t)MAX_THREADS)
+        {
+            throw std::runtime_error("corrupt v1 trace: thread id out of range");
+        }
+        auto type = (EventType)v1.type;
+        switch (type)
+        {
+            case EventType::Read:
+            case EventType::Write:
+            case EventType::Alloc:
+            case EventType::Free:
+            {
+                auto& me = v1.memoryEvent;
+                events[i] = Event(type, me.threadId, (void*)me.addr, me.size, dbgCtxt->findInstId(me.instAddr));
+                events[i].memoryEvent.varId = me.varId;
+                break;
+            }
+            case EventType::CallInst:
+            case EventType::Call:
+            case EventType::Ret:
+            {
+                auto& re = v1.routineEvent;
+                events[i] = Event(type, re.threadId, re.routineId, (void*)re.stackPointerRegister,
+                                  dbgCtxt->findInstId(re.instAddr));
+                break;
+            }
+            default:
+                throw std::runtime_error("corrupt v1 trace: unknown event type " + std::to_string(v1.type));
+        }
+        uint64_t t = v1.memoryEvent.t;
+        events[i].t = t > v1StartTime ? t - v1StartTime : 0;
+    }
+}
+
+void TraceReader::close()
+{
+    file.close();
+    blocks.clear();
+    summaries.clear();
+    version = 0;
+    sampling = trace::Sampling();
+    dbgCtxt = nullptr;
+    v1StartTime = 0;
+}
+
+bool TraceReader::isOpen() const
+{
+    return file.isOpen();
+}
+
+uint32_t TraceReader::getVersion() const
+{
+    return version;
+}
+
+const trace::Sampling& TraceReader::getSampling() const
+{
+    return sampling;
+}
+
+uint64_t TraceReader::getFileSize() const
+{
+    return file.size();
+}
+
+uint64_t TraceReader::getTotalEvents() const
+{
+    return blocks.empty() ? 0 : blocks.back().firstEvent + blocks.back().eventCount;
+}
+
+size_t TraceReader::getBlockCount() const
+{
+    return blocks.size();
+}
+
+const TraceBlock& TraceReader::getBlock(size_t i) const
+{
+    return blocks[i];
+}
+
+bool TraceReader::hasSummaries() const
+{
+    return !summaries.empty();
+}
+
+const trace::BlockSummary& TraceReader::getSummary(size_t i) const
+{
+    return summaries[i];
+}
+
+trace::BlockSummary& TraceReader::getSummary(size_t i)
+{
+    return summaries[i];
+}
+
+Event* TraceReader::loadBlock(size_t i)
+{
+    return decodeBlock(i, decoded, decompressed, decoder);
+}
+
+Event* TraceReader::decodeBlock(size_t i, std::vector<Event>& events, std::vector<uint8_t>& scratch,
+                                trace::BlockDecoder& decoder) const
+{
+    auto& block = blocks[i];
+    auto* payload = (const uint8_t*)file.begin() + block.offset;
+    if (version == 1)
+    {
+        events.resize(block.eventCount);
+        decodeV1(payload, block.eventCount, events.data());
+        return events.data();
+    }
+    bool sizesMatch = block.rawSize >= block.eventCount * trace::MinRecordSize &&
+                      block.rawSize <= block.eventCount * trace::MaxRecordSize &&
+                      (block.codec != trace::Codec::None || block.rawSize == block.payloadSize);
+    if (!sizesMatch)
+    {
+        throw std::runtime_error("corrupt trace: raw size of block " + std::to_string(i) + " doesn't match its records");
+    }
+    events.resize(block.eventCount);
+    if (block.codec != trace::Codec::None)
+    {
+        scratch.resize(block.rawSize);
+        if (!trace::decompressBlock(block.codec, payload, block.payloadSize, scratch.data(), scratch.size()))
+        {
+            throw std::runtime_error("corrupt trace: block " + std::to_string(i) + " can't be decompressed");
+        }
+        payload = scratch.data();
+    }
+    auto* end = payload + block.rawSize;
+    if (decoder.decode(payload, end, block.eventCount, events.data()) != end)
+    {
+        throw std::runtime_error("corrupt trace: block " + std::to_string(i) + " is longer than its records");
+    }
+    return events.data();
+}
+
+void TraceReader::prefetch(size_t i)
+{
+    if (i < blocks.size())
+    {
+        file.adviseWillNeed(blocks[i].offset, blocks[i].payloadSize);
+    }
+}
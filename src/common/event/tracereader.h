@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "blocksummary.h"
+#include "debuginfo/debugcontext.h"
+#include "event.h"
+#include "mappedfile.h"
+#include "traceformat.h"
+
+struct TraceBlock
+{
+    uint64_t offset;
+    uint64_t payloadSize;
+    uint64_t rawSize;
+    uint64_t firstEvent;
+    uint32_t eventCount;
+    trace::Codec codec;
+    int level;
+};
+
+//Gives block-wise access to a trace file of the current version or a v1 one.
+//Blocks are decoded from the read-only mapping into a buffer, v1 traces are split into blocks of fixed size.
+//The trace file itself is never modified
+class TraceReader
+{
+    MappedFile file;
+    uint32_t version = 0;
+    trace::Sampling sampling;
+    std::vector<TraceBlock> blocks;
+    std::vector<trace::BlockSummary> summaries;
+    std::vector<Event> decoded;
+    std::vector<uint8_t> decompressed;
+    trace::BlockDecoder decoder;
+    //translates instruction addresses of v1 events
+    const dbginfo::DebugContext* dbgCtxt = nullptr;
+    //v1 timestamps are absolute, they count from the first event
+    uint64_t v1StartTime = 0;
+
+    void scanBlocks();
+    bool loadIndex();
+    void splitV1Blocks();
+    void decodeV1(const uint8_t* payload, uint32_t count, Event* events) const;
+
+public:
+    //v1 traces need the debug context of the run
+    bool open(const std::string& path, const dbginfo::DebugContext* dbgCtxt = nullptr);
+    void close();
+    bool isOpen() const;
+    uint32_t getVersion() const;
+    const trace::Sampling& getSampling() const;
+    uint64_t getFileSize() const;
+    uint64_t getTotalEvents() const;
+    size_t getBlockCount() const;
+    const TraceBlock& getBlock(size_t i) const;
+    bool hasSummaries() const;
+    const trace::BlockSummary& getSummary(size_t i) const;
+    trace::BlockSummary& getSummary(size_t i);
+    Event* loadBlock(size_t i);
+    //thread safe, the block is decoded into events
+    Event* decodeBlock(size_t i, std::vector<Event>& events, std::vector<uint8_t>& scratch,
+                       trace::BlockDecoder& decoder) const;
+    void prefetch(size_t i);
+};
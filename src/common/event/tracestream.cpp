@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include "common/utils.h"
+#include "tracestream.h"
+
+TraceStream::TraceStream(const std::string& path, int threadId) :
+    path(path),
+    threadId(threadId)
+{
+}
+
+bool TraceStream::open(const dbginfo::DebugContext& dbgCtxt)
+{
+    return reader.open(path, &dbgCtxt);
+}
+
+std::string TraceStream::annotationPath(const std::string& tracePath)
+{
+    return tracePath + ".ann";
+}
+
+void TraceStream::rewind(bool writeBack)
+{
+    if (prefetcher)
+    {
+        prefetcher->stop();
+    }
+    plan.clear();
+    planPos = 0;
+    nextBlock = 0;
+    blockEvents = nullptr;
+    blockSize = 0;
+    blockPos = 0;
+    callStacksStale = false;
+    annotations.close();
+    if (!writeBack)
+    {
+        openAnnotations();
+        return;
+    }
+    //keep compression of the trace
+    for (size_t i = 0; i < reader.getBlockCount(); i++)
+    {
+        auto& block = reader.getBlock(i);
+        if (block.codec != trace::Codec::None)
+        {
+            annotationWriter.setCompression(block.codec, block.level);
+            break;
+        }
+    }
+    bool opened = annotationWriter.open(annotationPath(path));
+    assert(opened);
+}
+
+void TraceStream::openAnnotations()
+{
+    if (!annotations.open(annotationPath(path), reader.getFileSize()))
+    {
+        return;
+    }
+    bool matches = annotations.getBlockCount() == reader.getBlockCount();
+    for (size_t i = 0; matches && i < reader.getBlockCount(); i++)
+    {
+        matches = annotations.getEventCount(i) == reader.getBlock(i).eventCount;
+    }
+    if (!matches)
+    {
+        std::cout << "[WARNING] " << annotationPath(path) << " doesn't match the trace, ignored" << std::endl;
+        annotations.close();
+        return;
+    }
+    //var blooms of the trace are built before varIds are resolved
+    if (reader.hasSummaries())
+    {
+        for (size_t i = 0; i < reader.getBlockCount(); i++)
+        {
+            auto* bloom = annotations.getVarBloom(i);
+            auto& summary = reader.getSummary(i);
+            std::copy(bloom, bloom + trace::BlockSummary::BloomWords, summary.varBloom);
+        }
+    }
+}
+
+void TraceStream::startReading(size_t readAheadDepth)
+{
+    if (readAheadDepth == 0 || plan.empty())
+    {
+        return;
+    }
+    if (!prefetcher)
+    {
+        prefetcher.reset(new BlockPrefetcher(readAheadDepth));
+    }
+    prefetcher->start(reader, plan);
+}
+
+void TraceStream::loadNextBlock()
+{
+    if (annotationWriter.isOpen() && blockEvents)
+    {
+        annotationWriter.writeBlock(blockEvents, blockSize);
+    }
+    size_t block = plan[planPos++];
+    callStacksStale = block != nextBlock;
+    if (prefetcher)
+    {
+        blockEvents = prefetcher->take(block);
+    }
+    else
+    {
+        double t = utils::dsecnd();
+        blockEvents = reader.loadBlock(block);
+        stallTime += utils::dsecnd() - t;
+        //let the kernel fetch the next block while the current one is processed
+        if (hasNextBlock())
+        {
+            reader.prefetch(plan[planPos]);
+        }
+    }
+    blockSize = reader.getBlock(block).eventCount;
+    blockPos = 0;
+    if (annotations.isOpen())
+    {
+        annotations.apply(block, blockEvents, blockSize);
+    }
+    nextBlock = block + 1;
+}
+
+double TraceStream::getStallTime() const
+{
+    return stallTime + (prefetcher ? prefetcher->getStallTime() : 0);
+}
+
+void TraceStream::finishWriteBack()
+{
+    if (!annotationWriter.isOpen())
+    {
+        return;
+    }
+    while (hasNextBlock())
+    {
+        loadNextBlock();
+    }
+    if (blockEvents)
+    {
+        annotationWriter.writeBlock(blockEvents, blockSize);
+    }
+    annotationWriter.close(reader.getFileSize());
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "annotation.h"
+#include "blockprefetcher.h"
+#include "event.h"
+#include "tracereader.h"
+
+//Block cursor over one trace file (a whole trace or a shard of one thread) joined with its annotation sidecar.
+//Block skipping and call stack restoring depend on the global iteration state and are done by EventManager
+struct TraceStream
+{
+    std::string path;
+    //thread of the shard, -1 if the file holds events of all threads
+    int threadId;
+    TraceReader reader;
+    AnnotationReader annotations;
+    AnnotationWriter annotationWriter;
+    //blocks to be read, in order
+    std::vector<size_t> plan;
+    size_t planPos = 0;
+    size_t nextBlock = 0;
+    Event* blockEvents = nullptr;
+    uint32_t blockSize = 0;
+    uint32_t blockPos = 0;
+    //set if blocks were skipped before the current one
+    bool callStacksStale = false;
+    std::unique_ptr<BlockPrefetcher> prefetcher;
+    double stallTime = 0;
+
+    TraceStream(const std::string& path, int threadId);
+    bool open(const dbginfo::DebugContext& dbgCtxt);
+    //write back replaces the sidecar with varIds of the events read after rewind.
+    //The plan is cleared and has to be filled before startReading()
+    void rewind(bool writeBack);
+    //blocks are loaded on a background thread if readAheadDepth > 0
+    void startReading(size_t readAheadDepth);
+    void loadNextBlock();
+    //annotates the rest of the stream and closes the sidecar being written
+    void finishWriteBack();
+    static std::string annotationPath(const std::string& tracePath);
+    //seconds spent waiting for blocks to be loaded
+    double getStallTime() const;
+
+    bool hasNextBlock() const
+    {
+        return planPos < plan.size();
+    }
+
+    bool hasEvent() const
+    {
+        return blockPos < blockSize;
+    }
+
+    Event& current()
+    {
+        return blockEvents[blockPos];
+    }
+
+private:
+    void openAnnotations();
+};
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "config.h"
+#include "tracewriter.h"
+
+const uint64_t TraceWriter::PreallocationSize = 64 << 20;
+
+TraceWriter::TraceWriter() :
+    callStackGlobal(MAX_THREADS)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+//the file keeps its size, so a trace of a killed run ends at its last block
+void TraceWriter::preallocate(uint64_t size)
+{
+    if (offset + size <= allocated)
+    {
+        return;
+    }
+    uint64_t length = std::max(size, PreallocationSize);
+    //not supported by every file system, then blocks are allocated by writes
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, offset + length - allocated);
+    allocated = offset + length;
+}
+
+void TraceWriter::append(iovec* iov, int count)
+{
+    size_t size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size += iov[i].iov_len;
+    }
+    preallocate(size);
+    while (count > 0)
+    {
+        ssize_t written = pwritev(fd, iov, count, offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        assert(written > 0);
+        offset += written;
+        //partial write, skip what was written
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+void TraceWriter::setCompression(trace::Codec codec, int level)
+{
+    this->codec = trace::isCodecAvailable(codec) ? codec : trace::Codec::None;
+    this->level = level;
+}
+
+void TraceWriter::setSampling(const trace::Sampling& sampling)
+{
+    this->sampling = sampling;
+}
+
+bool TraceWriter::open(const std::string& path, const dbginfo::DebugContext& dbgContext)
+{
+    close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    offset = 0;
+    allocated = 0;
+    this->dbgContext = &dbgContext;
+    totalEvents = 0;
+    callStackGlobal.clear();
+    index.clear();
+    summaries.clear();
+    trace::TraceHeader header;
+    header.sampling = sampling;
+    iovec iov[] = {{&header, sizeof(header)}};
+    append(iov, 1);
+    return true;
+}
+
+void TraceWriter::close()
+{
+    if (fd >= 0)
+    {
+        writeIndex();
+        //releases the preallocated space past the end
+        int ret = ftruncate(fd, offset);
+        assert(ret == 0);
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool TraceWriter::isOpen() const
+{
+    return fd >= 0;
+}
+
+void TraceWriter::writeBlock(const Event* events, size_t eventCount)
+{
+    if (eventCount == 0)
+    {
+        return;
+    }
+    assert(eventCount <= UINT32_MAX);
+    trace::BlockSummary summary;
+    summary.addCallStacks(callStackGlobal);
+    payload.clear();
+    encoder.reset();
+    for (size_t i = 0; i < eventCount; i++)
+    {
+        encoder.encode(events[i], payload);
+        summary.add(events[i]);
+        callStackGlobal.handleEvent(events[i], *dbgContext);
+    }
+    summary.finish();
+
+    trace::BlockHeader header;
+    header.eventCount = eventCount;
+    header.rawSize = payload.size();
+    //incompressible blocks are stored as is
+    auto* data = &payload;
+    if (trace::compressBlock(codec, level, payload.data(), payload.size(), compressed))
+    {
+        header.codec = codec;
+        header.level = level;
+        data = &compressed;
+    }
+    header.payloadSize = data->size();
+
+    trace::BlockIndexEntry entry;
+    entry.offset = offset + sizeof(header);
+    entry.header = header;
+    index.push_back(entry);
+    summaries.push_back(std::move(summary));
+
+    iovec iov[] = {{&header, sizeof(header)}, {data->data(), data->size()}};
+    append(iov, 2);
+    totalEvents += eventCount;
+}
+
+void TraceWriter::writeIndex()
+{
+    trace::IndexTrailer trailer;
+    trailer.indexOffset = offset;
+    trailer.blockCount = index.size();
+    std::ostringstream out;
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        utils::save(index[i], out);
+        summaries[i].save(out);
+    }
+    utils::save(trailer, out);
+    std::string data = out.str();
+    iovec iov[] = {{&data[0], data.size()}};
+    append(iov, 1);
+}
+
+uint64_t TraceWriter::getTotalEvents() const
+{
+    return totalEvents;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "blocksummary.h"
+#include "callstack.h"
+#include "debuginfo/debugcontext.h"
+#include "event.h"
+#include "traceformat.h"
+
+struct iovec;
+
+//Blocks are appended with positioned writes to a descriptor kept open for the whole trace,
+//file space is preallocated in large chunks to keep the file contiguous
+class TraceWriter
+{
+    static const uint64_t PreallocationSize;
+
+    int fd = -1;
+    uint64_t offset = 0;
+    uint64_t allocated = 0;
+    const dbginfo::DebugContext* dbgContext = nullptr;
+    trace::BlockEncoder encoder;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> compressed;
+    uint64_t totalEvents = 0;
+    trace::Codec codec = trace::Codec::None;
+    int level = 1;
+    trace::Sampling sampling;
+
+    //call stacks are tracked to snapshot them at block boundaries
+    CallStackGlobal callStackGlobal;
+    std::vector<trace::BlockIndexEntry> index;
+    std::vector<trace::BlockSummary> summaries;
+
+    void writeIndex();
+    void preallocate(uint64_t size);
+    void append(iovec* iov, int count);
+
+public:
+    TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+    ~TraceWriter();
+    void setCompression(trace::Codec codec, int level);
+    //recorded in the header, has to be set before open()
+    void setSampling(const trace::Sampling& sampling);
+    bool open(const std::string& path, const dbginfo::DebugContext& dbgContext);
+    void close();
+    bool isOpen() const;
+    void writeBlock(const Event* events, size_t eventCount);
+    uint64_t getTotalEvents() const;
+};
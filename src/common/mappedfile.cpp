@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mappedfile.h"
+
+//madvise requires page aligned addresses
+static void pageAlign(char* base, size_t offset, size_t count, char** alignedBegin, size_t* alignedCount)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t begin = offset / pageSize * pageSize;
+    *alignedBegin = base + begin;
+    *alignedCount = offset + count - begin;
+}
+
+MappedFile::MappedFile(MappedFile&& f) :
+    fd(f.fd),
+    data(f.data),
+    length(f.length)
+{
+    f.fd = -1;
+    f.data = nullptr;
+    f.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& f)
+{
+    if (this != &f)
+    {
+        close();
+        std::swap(fd, f.fd);
+        std::swap(data, f.data);
+        std::swap(length, f.length);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close();
+        return false;
+    }
+    length = st.st_size;
+    if (length == 0)
+    {
+        return true;
+    }
+    void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    data = (char*)p;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data)
+    {
+        munmap(data, length);
+        data = nullptr;
+    }
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    length = 0;
+}
+
+bool MappedFile::isOpen() const
+{
+    return fd != -1;
+}
+
+const char* MappedFile::begin() const
+{
+    return data;
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
+
+void MappedFile::adviseSequential()
+{
+    if (data)
+    {
+        madvise(data, length, MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::adviseWillNeed(size_t offset, size_t count)
+{
+    if (!data || offset >= length)
+    {
+        return;
+    }
+    char* p;
+    size_t n;
+    pageAlign(data, offset, std::min(count, length - offset), &p, &n);
+    madvise(p, n, MADV_WILLNEED);
+}
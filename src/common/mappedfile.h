@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+//read-only view of a whole file through mmap
+class MappedFile
+{
+    int fd = -1;
+    char* data = nullptr;
+    size_t length = 0;
+
+    MappedFile(const MappedFile& f) = delete;
+    MappedFile& operator=(const MappedFile& f) = delete;
+
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile&& f);
+    MappedFile& operator=(MappedFile&& f);
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    const char* begin() const;
+    size_t size() const;
+    void adviseSequential();
+    void adviseWillNeed(size_t offset, size_t count);
+};
@@ -5,16 +5,21 @@ struct LocalityInfo
 {
     double spatialLocality;
     double temporalLocality;
+    //strides and reuse distances of a sampled trace are those of the recorded accesses only,
+    //the values don't estimate the locality of the whole run
+    bool sampled;
 
-    LocalityInfo(double spatialLocality, double temporalLocality):
+    LocalityInfo(double spatialLocality, double temporalLocality, bool sampled = false):
         spatialLocality(spatialLocality),
-        temporalLocality(temporalLocality)
+        temporalLocality(temporalLocality),
+        sampled(sampled)
     {
     }
 
     std::string str() const
     {
         return "[spatial = " + std::to_string(spatialLocality) +
-             "; temporal = " + std::to_string(temporalLocality) + "]";
+             "; temporal = " + std::to_string(temporalLocality) + "]" +
+             (sampled ? " of the sampled accesses" : "");
     }
 };
\ No newline at end of file
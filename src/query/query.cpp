@@ -4,17 +4,45 @@
 #include "config.h"
 #include "querymanager/querymanager.h"
 #include "querymanager/querycontext.h"
+#include "querymanager/profileinfo.h"
 using namespace std;
 
-int main()
+//optional argument is the directory with the trace, e.g. written by slice.exe
+int main(int argc, char* argv[])
 {
+    std::string dir = argc > 1 ? argv[1] : ".";
     dbginfo::DebugContext debugContext;
-    std::ifstream dbgIn(DEBUG_INFO_PATH, std::ios::binary);
+    std::ifstream dbgIn(dir + "/" + DEBUG_INFO_PATH, std::ios::binary);
     debugContext.load(dbgIn);
 
+    //the tool writes a profile instead of a trace in its profile mode
+    std::ifstream profileIn(dir + "/" + PROFILE_PATH, std::ios::binary);
+    if (profileIn)
+    {
+        Profile profile;
+        profile.load(profileIn);
+        auto sampling = profile.getSampling();
+        if (sampling.isEnabled())
+        {
+            cout << "[INFO] sampled profile: " << sampling.getFraction() * 100 << "% of accesses counted, counts are scaled" << endl;
+        }
+        ProfileInfo profileInfo(debugContext, profile);
+        cout << profileInfo.getAccessMatrix().str() << endl;
+        cout << profileInfo.funcStr() << endl;
+        cout << profileInfo.hotInstStr(20) << endl;
+        return 0;
+    }
+
     EventManager eventManager(debugContext);
-    std::ifstream eventIn(EVENT_REF_PATH, std::ios::binary);
-    eventManager.load(eventIn);
+    std::ifstream eventIn(dir + "/" + EVENT_REF_PATH, std::ios::binary);
+    eventManager.load(eventIn, dir);
+    eventManager.setReadAhead(4);
+
+    for (auto& region: eventManager.getRegions())
+    {
+        cout << "[INFO] region " << region.name << " of thread " << region.threadId
+             << ": [" << region.begin << "; " << region.end << ")" << endl;
+    }
 
     QueryContext qctxt;
     QueryManager qm(eventManager, qctxt);
@@ -24,9 +52,15 @@ int main()
     auto localityInfo = qm.getLocalities();
     auto patternInfo = qm.getAccessPatterns();
 
+    auto sampling = eventManager.getSampling();
+    if (sampling.isEnabled())
+    {
+        cout << "[INFO] sampled trace: " << sampling.getFraction() * 100 << "% of accesses recorded, counts are scaled" << endl;
+    }
     cout << accMat.str() << endl;
     cout << localityInfo.str() << endl;
     cout << patternInfo.str() << endl;
+    cout << "[INFO] waited for trace blocks: " << eventManager.getStallTime() << " s" << endl;
 
     
     return 0;
@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cmath>
 #include <map>
 #include <string>
 #include <vector>
@@ -11,7 +12,7 @@ struct AccessMatrixEntry
 {
     const dbginfo::VarInfo* varInfo;
     std::map<int, AccessType> threadAccessTypes;
-    int accessed = 0;
+    uint64_t accessed = 0;
 
     std::string accessTypeStr(int ithr) const
     {
@@ -53,14 +54,35 @@ class AccessMatrix
     const dbginfo::DebugContext& debugContext;
     std::map<int, AccessMatrixEntry> entries;
     std::set<int> threads;
+    trace::Sampling sampling;
 
 public:
     AccessMatrix(EventManager& eventManager):
         totalThreads(eventManager.getTotalThreads()),
-        debugContext(eventManager.getDebugContext())
+        debugContext(eventManager.getDebugContext()),
+        sampling(eventManager.getSampling())
     {
     }
 
+    //filled by addAccesses from aggregated counts, e.g. of a profile
+    AccessMatrix(const dbginfo::DebugContext& debugContext, int totalThreads, const trace::Sampling& sampling):
+        totalThreads(totalThreads),
+        debugContext(debugContext),
+        sampling(sampling)
+    {
+    }
+
+    //counts and bytes of sampled traces are scaled to the whole run. Sampling takes every n-th
+    //access or periodic bursts rather than random ones, so there is no confidence interval
+    std::string countStr(uint64_t count) const
+    {
+        if (!sampling.isEnabled())
+        {
+            return std::to_string(count);
+        }
+        return std::to_string((uint64_t)std::llround(count / sampling.getFraction()));
+    }
+
     void addMemoryEvent(const Event& event)
     {
         assert(event.type == EventType::Read || event.type == EventType::Write);
@@ -69,20 +91,25 @@ public:
         {
             return;
         }
-        if (entries.find(me.varId) == entries.end())
+        addAccesses(me.varId, event.threadId, event.type, 1);
+    }
+
+    void addAccesses(int varId, int threadId, EventType type, uint64_t count)
+    {
+        if (entries.find(varId) == entries.end())
         {
-            entries[me.varId].varInfo = debugContext.findVarById(me.varId);
-            if (!entries[me.varId].varInfo)
+            entries[varId].varInfo = debugContext.findVarById(varId);
+            if (!entries[varId].varInfo)
             {
-                auto* varInfo = debugContext.findVarById(me.varId);
+                auto* varInfo = debugContext.findVarById(varId);
                 std::cout << varInfo;
             }
         }
-        entries[me.varId].accessed++;
-        threads.insert(me.threadId);
-        auto& t = entries[me.varId].threadAccessTypes[me.threadId];
+        entries[varId].accessed += count;
+        threads.insert(threadId);
+        auto& t = entries[varId].threadAccessTypes[threadId];
 
-        switch (event.type)
+        switch (type)
         {
             case EventType::Read:
                 t = (AccessType)((int)t | (int)AccessType::Read);
@@ -140,7 +167,7 @@ public:
             row.push_back(e.second.varInfo->srcLoc.str());
             row.push_back(e.second.varInfo->name);
             row.push_back(std::to_string(e.second.varInfo->size));
-            row.push_back(std::to_string(e.second.accessed));
+            row.push_back(countStr(e.second.accessed));
             for (auto ithr: threads)
             {
                 row.push_back(e.second.accessTypeStr(ithr));
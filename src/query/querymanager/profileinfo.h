@@ -0,0 +1,95 @@
+#pragma once
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "accessmatrix.h"
+#include "common/debuginfo/debugcontext.h"
+#include "common/event/profile.h"
+#include "common/streamutils/table.h"
+
+//Tables of a profile written by the tool instead of a trace
+class ProfileInfo
+{
+    const dbginfo::DebugContext& debugContext;
+    const Profile& profile;
+    AccessMatrix accessMatrix;
+
+    static std::set<int> getThreads(const Profile& profile)
+    {
+        std::set<int> threads;
+        for (auto& e: profile.getVarCounts())
+        {
+            threads.insert(e.first.second);
+        }
+        return threads;
+    }
+
+public:
+    ProfileInfo(const dbginfo::DebugContext& debugContext, const Profile& profile):
+        debugContext(debugContext),
+        profile(profile),
+        accessMatrix(debugContext, getThreads(profile).size(), profile.getSampling())
+    {
+        for (auto& e: profile.getVarCounts())
+        {
+            int varId = e.first.first;
+            if (varId < 0)
+            {
+                continue;
+            }
+            if (e.second.reads > 0)
+            {
+                accessMatrix.addAccesses(varId, e.first.second, EventType::Read, e.second.reads);
+            }
+            if (e.second.writes > 0)
+            {
+                accessMatrix.addAccesses(varId, e.first.second, EventType::Write, e.second.writes);
+            }
+        }
+        accessMatrix.merge();
+    }
+
+    const AccessMatrix& getAccessMatrix() const
+    {
+        return accessMatrix;
+    }
+
+    std::string funcStr() const
+    {
+        streamutils::Table table;
+        table.addColumn("Function");
+        table.addColumn("Reads");
+        table.addColumn("Writes");
+        table.addColumn("Bytes");
+        for (auto& e: profile.getFuncCounts())
+        {
+            auto* funcInfo = debugContext.findFuncById(e.first);
+            table.addRow({funcInfo ? funcInfo->name : "<unknown>",
+                          accessMatrix.countStr(e.second.reads),
+                          accessMatrix.countStr(e.second.writes),
+                          accessMatrix.countStr(e.second.bytes)});
+        }
+        return table.str();
+    }
+
+    std::string hotInstStr(size_t count) const
+    {
+        streamutils::Table table;
+        table.addColumn("Instruction");
+        table.addColumn("Source");
+        table.addColumn("Reads");
+        table.addColumn("Writes");
+        for (auto& e: profile.getHotInsts(count))
+        {
+            uint64_t inst = debugContext.findInstById(e.first);
+            std::ostringstream oss;
+            oss << "0x" << std::hex << inst;
+            auto sourceLoc = debugContext.getInstSourceLocation(e.first);
+            table.addRow({oss.str(),
+                          sourceLoc ? sourceLoc.str() : "-",
+                          accessMatrix.countStr(e.second.reads),
+                          accessMatrix.countStr(e.second.writes)});
+        }
+        return table.str();
+    }
+};
@@ -1,7 +1,10 @@
 #pragma once
+#include <algorithm>
 #include <set>
 #include <vector>
+#include "common/event/blocksummary.h"
 #include "common/event/event.h"
+#include "common/event/region.h"
 #include "common/debuginfo/debugcontext.h"
 
 class QueryContext
@@ -12,6 +15,32 @@ class QueryContext
     bool funcsEnabled = false;
     std::set<int> funcs;
 
+    bool varsEnabled = false;
+    std::set<int> vars;
+
+    bool timeEnabled = false;
+    uint64_t timeBegin = 0;
+    uint64_t timeEnd = UINT64_MAX;
+
+    bool regionsEnabled = false;
+    std::vector<Region> regions;
+
+    bool inRegions(uint64_t begin, uint64_t end) const
+    {
+        return std::any_of(regions.begin(), regions.end(), [&](const Region& region)
+        {
+            return region.begin <= end && begin < region.end;
+        });
+    }
+
+    bool inRegions(const Event& e) const
+    {
+        return std::any_of(regions.begin(), regions.end(), [&](const Region& region)
+        {
+            return region.contains(e.getThreadId(), e.getTime());
+        });
+    }
+
 public:
     QueryContext():
         threads(MAX_THREADS, false)
@@ -46,6 +75,42 @@ public:
         return *this;
     }
 
+    QueryContext& acceptVar(const dbginfo::VarInfo* varInfo)
+    {
+        varsEnabled = true;
+        vars.insert(varInfo->id);
+        return *this;
+    }
+
+    QueryContext& rejectVar(const dbginfo::VarInfo* varInfo)
+    {
+        varsEnabled = true;
+        vars.erase(varInfo->id);
+        return *this;
+    }
+
+    //accepts events with timestamps in [begin; end)
+    QueryContext& acceptTime(uint64_t begin, uint64_t end)
+    {
+        timeEnabled = true;
+        timeBegin = begin;
+        timeEnd = end;
+        return *this;
+    }
+
+    //accepts events recorded within the window of the region
+    QueryContext& acceptRegion(const Region& region)
+    {
+        regionsEnabled = true;
+        regions.push_back(region);
+        return *this;
+    }
+
+    bool accept(int ithr) const
+    {
+        return !threadsEnabled || threads[ithr];
+    }
+
     bool accept(const Event& e, const dbginfo::FuncInfo* funcInfo) const
     {
         if (threadsEnabled && !threads[e.getThreadId()])
@@ -56,6 +121,58 @@ public:
         {
             return false;
         }
+        if (varsEnabled)
+        {
+            bool isMemoryEvent = e.type == EventType::Read || e.type == EventType::Write;
+            if (!isMemoryEvent || vars.find(e.memoryEvent.varId) == vars.end())
+            {
+                return false;
+            }
+        }
+        if (timeEnabled && (e.getTime() < timeBegin || e.getTime() >= timeEnd))
+        {
+            return false;
+        }
+        if (regionsEnabled && !inRegions(e))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    //false if none of the block events can be accepted
+    bool accept(const trace::BlockSummary& summary) const
+    {
+        if (threadsEnabled)
+        {
+            bool found = false;
+            for (size_t i = 0; i < threads.size() && !found; i++)
+            {
+                found = threads[i] && summary.hasThread(i);
+            }
+            if (!found)
+            {
+                return false;
+            }
+        }
+        if (funcsEnabled &&
+            std::none_of(funcs.begin(), funcs.end(), [&](int id) { return summary.hasRoutine(id); }))
+        {
+            return false;
+        }
+        if (varsEnabled &&
+            std::none_of(vars.begin(), vars.end(), [&](int id) { return summary.mayHaveVar(id); }))
+        {
+            return false;
+        }
+        if (timeEnabled && (summary.maxT < timeBegin || summary.minT >= timeEnd))
+        {
+            return false;
+        }
+        if (regionsEnabled && !inRegions(summary.minT, summary.maxT))
+        {
+            return false;
+        }
         return true;
     }
 };
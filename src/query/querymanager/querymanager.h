@@ -28,6 +28,14 @@ public:
         debugContext(eventManager.getDebugContext()),
         queryContext(queryContext)
     {
+        eventManager.setBlockFilter([&queryContext](const trace::BlockSummary& summary)
+        {
+            return queryContext.accept(summary);
+        });
+        eventManager.setThreadFilter([&queryContext](int threadId)
+        {
+            return queryContext.accept(threadId);
+        });
     }
 
     LocalityInfo getLocalities()
@@ -51,7 +59,8 @@ public:
                 }
             }
         }
-        return LocalityInfo(spatialLocality.getValue(), temporalLocality.getValue());
+        return LocalityInfo(spatialLocality.getValue(), temporalLocality.getValue(),
+                            eventManager.getSampling().isEnabled());
     }
 
     AccessMatrix getAccessMatrix()
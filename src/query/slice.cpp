@@ -0,0 +1,138 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include "common/event/eventmanager.h"
+#include "config.h"
+#include "querymanager/querycontext.h"
+#include "slice/traceslicer.h"
+using namespace std;
+
+static void usage()
+{
+    cerr << "usage: slice.exe <output dir> [options]" << endl
+         << "  -input <dir>          directory with the trace to slice, current directory by default" << endl
+         << "  -thread <id>          keep events of the thread, may be repeated" << endl
+         << "  -func <name>          keep memory events of the function, may be repeated" << endl
+         << "  -var <name>           keep memory events of the variable, may be repeated" << endl
+         << "  -region <name>        keep events recorded in the region, may be repeated" << endl
+         << "  -time <begin> <end>   keep events with timestamps in [begin; end)" << endl
+         << "  -events <begin> <end> keep events with indices in [begin; end)" << endl
+         << "  -compress <codec>     none, lz or zstd" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+    string outDir = argv[1];
+    string inDir = ".";
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-input") && i + 1 < argc)
+        {
+            inDir = argv[++i];
+        }
+    }
+
+    dbginfo::DebugContext debugContext;
+    std::ifstream dbgIn(inDir + "/" + DEBUG_INFO_PATH, std::ios::binary);
+    debugContext.load(dbgIn);
+
+    EventManager eventManager(debugContext);
+    std::ifstream eventIn(inDir + "/" + EVENT_REF_PATH, std::ios::binary);
+    eventManager.load(eventIn, inDir);
+    eventManager.setReadAhead(4);
+
+    QueryContext qctxt;
+    TraceSlicer slicer(eventManager, qctxt);
+    for (int i = 2; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-input" && i + 1 < argc)
+        {
+            i++;
+        }
+        else if (arg == "-thread" && i + 1 < argc)
+        {
+            qctxt.acceptThread(atoi(argv[++i]));
+        }
+        else if (arg == "-func" && i + 1 < argc)
+        {
+            auto* funcInfo = debugContext.findFuncByName(argv[++i]);
+            if (!funcInfo)
+            {
+                cerr << "Unknown function: " << argv[i] << endl;
+                return 1;
+            }
+            qctxt.acceptFunc(funcInfo);
+        }
+        else if (arg == "-region" && i + 1 < argc)
+        {
+            string name = argv[++i];
+            bool found = false;
+            for (auto& region: eventManager.getRegions())
+            {
+                if (region.name == name)
+                {
+                    qctxt.acceptRegion(region);
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                cerr << "Unknown region: " << name << endl;
+                return 1;
+            }
+        }
+        else if (arg == "-var" && i + 1 < argc)
+        {
+            auto vars = debugContext.findVarsByName(argv[++i]);
+            if (vars.empty())
+            {
+                cerr << "Unknown variable: " << argv[i] << endl;
+                return 1;
+            }
+            for (auto* varInfo: vars)
+            {
+                qctxt.acceptVar(varInfo);
+            }
+        }
+        else if (arg == "-time" && i + 2 < argc)
+        {
+            uint64_t begin = strtoull(argv[i + 1], nullptr, 0);
+            uint64_t end = strtoull(argv[i + 2], nullptr, 0);
+            slicer.setTimeWindow(begin, end);
+            i += 2;
+        }
+        else if (arg == "-events" && i + 2 < argc)
+        {
+            uint64_t begin = strtoull(argv[i + 1], nullptr, 0);
+            uint64_t end = strtoull(argv[i + 2], nullptr, 0);
+            slicer.setIndexWindow(begin, end);
+            i += 2;
+        }
+        else if (arg == "-compress" && i + 1 < argc)
+        {
+            trace::Codec codec;
+            if (!trace::parseCodec(argv[++i], &codec) || !trace::isCodecAvailable(codec))
+            {
+                cerr << "Compression is not available: " << argv[i] << endl;
+                return 1;
+            }
+            slicer.setCompression(codec, 1);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    uint64_t events = slicer.slice(outDir);
+    cout << "[INFO] slice written to " << outDir << ": " << events << " events" << endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+#include "common/event/tracestream.h"
+#include "config.h"
+#include "traceslicer.h"
+
+TraceSlicer::TraceSlicer(EventManager& eventManager, const QueryContext& queryContext) :
+    eventManager(eventManager),
+    queryContext(queryContext)
+{
+}
+
+TraceSlicer& TraceSlicer::setTimeWindow(uint64_t begin, uint64_t end)
+{
+    timeBegin = begin;
+    timeEnd = end;
+    return *this;
+}
+
+TraceSlicer& TraceSlicer::setIndexWindow(uint64_t begin, uint64_t end)
+{
+    indexBegin = begin;
+    indexEnd = end;
+    return *this;
+}
+
+TraceSlicer& TraceSlicer::setCompression(trace::Codec codec, int level)
+{
+    this->codec = codec;
+    this->level = level;
+    return *this;
+}
+
+void TraceSlicer::add(const Event& e)
+{
+    events.push_back(e);
+    if (events.size() >= blockSize)
+    {
+        flush();
+    }
+}
+
+void TraceSlicer::flush()
+{
+    if (events.empty())
+    {
+        return;
+    }
+    writer.writeBlock(events.data(), events.size());
+    annotationWriter.writeBlock(events.data(), events.size());
+    totalEvents += events.size();
+    events.clear();
+}
+
+void TraceSlicer::addCallStacks(uint64_t t)
+{
+    auto& callStacks = eventManager.getCallStacks().callStacks;
+    for (size_t threadId = 0; threadId < callStacks.size(); threadId++)
+    {
+        if (!queryContext.accept(threadId))
+        {
+            continue;
+        }
+        for (auto& call: callStacks[threadId].calls)
+        {
+            void* stackPointer = (char*)call.frameBase - call.funcInfo->stackOffset;
+            Event e(EventType::Call, threadId, call.funcInfo->id, stackPointer);
+            e.t = t;
+            add(e);
+        }
+    }
+}
+
+uint64_t TraceSlicer::slice(const std::string& dir)
+{
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/bin").c_str(), 0755);
+    char buf[PATH_MAX];
+    bool resolved = realpath(dir.c_str(), buf);
+    assert(resolved);
+    //absolute path keeps the reference valid wherever queries are run from
+    std::string outDir = buf;
+    std::string eventPath = outDir + "/" + BIN_EVENT_PATH;
+
+    auto& dbgContext = eventManager.getDebugContext();
+    writer.setCompression(codec, level);
+    writer.setSampling(eventManager.getSampling());
+    annotationWriter.setCompression(codec, level);
+    bool opened = writer.open(eventPath, dbgContext) && annotationWriter.open(TraceStream::annotationPath(eventPath));
+    assert(opened);
+    totalEvents = 0;
+
+    uint64_t begin = timeBegin;
+    uint64_t end = timeEnd;
+    bool indexed = indexBegin > 0 || indexEnd < UINT64_MAX;
+    eventManager.setBlockFilter([=](const trace::BlockSummary& summary)
+    {
+        //skipped blocks would shift event indices
+        return indexed || (summary.maxT >= begin && summary.minT < end);
+    });
+    eventManager.setThreadFilter([this](int threadId)
+    {
+        return queryContext.accept(threadId);
+    });
+    eventManager.reset();
+
+    uint64_t index = 0;
+    bool inside = false;
+    while (eventManager.hasNext())
+    {
+        Event& e = eventManager.next();
+        uint64_t i = index++;
+        if (i < indexBegin || e.getTime() < timeBegin)
+        {
+            continue;
+        }
+        if (i >= indexEnd || e.getTime() >= timeEnd)
+        {
+            break;
+        }
+        bool stackEvent = e.type == EventType::Call || e.type == EventType::Ret;
+        if (!inside)
+        {
+            inside = true;
+            //call stacks already include the first event
+            addCallStacks(e.getTime());
+            if (stackEvent)
+            {
+                continue;
+            }
+        }
+        int threadId = e.getThreadId();
+        if (!queryContext.accept(threadId))
+        {
+            continue;
+        }
+        if (e.type == EventType::Read || e.type == EventType::Write)
+        {
+            if (queryContext.accept(e, eventManager.topFuncInfo(threadId)))
+            {
+                add(e);
+            }
+        }
+        else
+        {
+            add(e);
+        }
+    }
+    flush();
+    writer.close();
+    struct stat st;
+    int ret = stat(eventPath.c_str(), &st);
+    assert(ret == 0);
+    annotationWriter.close(st.st_size);
+
+    EventManager sliced(dbgContext, eventPath, totalEvents);
+    sliced.setRegions(eventManager.getRegions());
+    std::ofstream refOut(outDir + "/" + EVENT_REF_PATH, std::ios::binary);
+    sliced.save(refOut);
+    std::ofstream dbgOut(outDir + "/" + DEBUG_INFO_PATH, std::ios::binary);
+    dbgContext.save(dbgOut);
+    return totalEvents;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "common/event/annotation.h"
+#include "common/event/eventmanager.h"
+#include "common/event/tracewriter.h"
+#include "query/querymanager/querycontext.h"
+
+//Copies events of a window accepted by the query context into a new self-contained trace.
+//Call/Ret events of accepted threads are always kept and call stacks at the window start
+//are written as Call events, so stack attribution in the slice matches the original trace
+class TraceSlicer
+{
+    EventManager& eventManager;
+    const QueryContext& queryContext;
+    uint64_t timeBegin = 0;
+    uint64_t timeEnd = UINT64_MAX;
+    uint64_t indexBegin = 0;
+    uint64_t indexEnd = UINT64_MAX;
+    size_t blockSize = 1 << 20;
+    trace::Codec codec = trace::Codec::None;
+    int level = 1;
+
+    TraceWriter writer;
+    AnnotationWriter annotationWriter;
+    std::vector<Event> events;
+    uint64_t totalEvents = 0;
+
+    void add(const Event& e);
+    void flush();
+    void addCallStacks(uint64_t t);
+
+public:
+    TraceSlicer(EventManager& eventManager, const QueryContext& queryContext);
+    //events with timestamps in [begin; end)
+    TraceSlicer& setTimeWindow(uint64_t begin, uint64_t end);
+    //events with indices in [begin; end) of the whole trace, disables skipping of blocks
+    TraceSlicer& setIndexWindow(uint64_t begin, uint64_t end);
+    TraceSlicer& setCompression(trace::Codec codec, int level);
+    //writes trace, event reference and debug info into dir/bin, returns number of events in the slice
+    uint64_t slice(const std::string& dir);
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include "execcontext.h"
 using namespace std;
@@ -6,14 +7,13 @@ VOID Fini(INT32 code, VOID *v);
 
 namespace pin
 {
-    SourceLocation getSourceLocation(ADDRINT inst)
+    //the client lock has to be held
+    static SourceLocation getSourceLocationLocked(ADDRINT inst)
     {
         int column;
         int line;
         string fileName;
-        PIN_LockClient();
         PIN_GetSourceLocation(inst, &column, &line, &fileName);
-        PIN_UnlockClient();
         return SourceLocation(fileName, line);
     }
 
@@ -108,30 +108,30 @@ namespace pin
     {
         static int id = 0;
         //std::string varName = getVarNameFromFile(srcLoc);
-        std::cout << "alloc __dyn_#" + std::to_string(id) << " " << memoryEvent.addr << std::endl;
         auto* varInfo = dbgCtxt.addVar(dbginfo::VarInfo(dbginfo::StorageType::Dynamic,
                                                         "__dyn_" + std::to_string(id++),
-                                                        memoryEvent.size, memoryEvent.size,
-                                                        (ssize_t)memoryEvent.addr, srcLoc));
+                                                        memoryEvent.getAllocSize(), memoryEvent.getAllocSize(),
+                                                        (ssize_t)memoryEvent.getAddr(), srcLoc));
         memoryEvent.varId = varInfo->id;
-        auto ret = objects.insert(MemoryObject(memoryEvent.addr, memoryEvent.size, varInfo));
-        assert(ret.second);
+        //the previous object at the address was released by an untracked call, e.g. a partial munmap
+        MemoryObject mo(memoryEvent.getAddr(), memoryEvent.getAllocSize(), varInfo);
+        objects.erase(mo);
+        objects.insert(mo);
     }
 
     void HeapInfo::handleFree(dbginfo::DebugContext& dbgCtxt, MemoryEvent& memoryEvent)
     {
-        auto it = objects.find(MemoryObject(memoryEvent.addr));
+        auto it = objects.find(MemoryObject(memoryEvent.getAddr()));
         if (it == objects.end())
         {
             return;
         }
-        std::cout << "free " << it->varInfo->name << " " << memoryEvent.addr << std::endl;
         objects.erase(it);
     }
 
-    MemoryObject HeapInfo::findObject(const MemoryEvent& memoryEvent) const
+    MemoryObject HeapInfo::findObject(const dbginfo::DebugContext& dbgCtxt, const MemoryEvent& memoryEvent) const
     {
-        size_t size = memoryEvent.size;
+        size_t size = memoryEvent.access.size;
         void* addr = memoryEvent.addr;
         auto it = lessFirst(objects, addr);
         if (it == objects.end())
@@ -143,7 +143,7 @@ namespace pin
         {
             if (!((char*)addr + size <= it->hi()))
             {
-                auto sourceLoc = getSourceLocation(memoryEvent.instAddr);
+                auto sourceLoc = dbgCtxt.getInstSourceLocation(memoryEvent.access.instId);
                 std::cout << sourceLoc.str() << std::endl;
                 std::cout << "assert 131: " << std::endl;
                 std::cout << addr << std::endl;
@@ -160,21 +160,32 @@ namespace pin
     //ExecContext
     //------------------------------------------------------------------------------
 
-    ExecContext::ExecContext(const std::string& binPath, dbginfo::DebugContext& dbgCtxt) :
+    ExecContext::ExecContext(const std::string& binPath, dbginfo::DebugContext& dbgCtxt,
+                             const ToolOptions& options) :
         binPath(binPath),
         dbgCtxt(dbgCtxt),
-        callStackGlobal(MAX_THREADS)
-
+        callStackGlobal(MAX_THREADS),
+        eventDumper(dbgCtxt, options),
+        heapSupportEnabled(options.heapTracking),
+        onlineResolution(options.onlineResolution),
+        callInsts(MAX_THREADS),
+        resolvedCounts(MAX_THREADS),
+        stackRanges(MAX_THREADS),
+        profileMode(options.profile),
+        threadProfiles(MAX_THREADS),
+        openRegions(MAX_THREADS)
     {
+        profile.setSampling(options.sampling);
+        PIN_RWMutexInit(&heapLock);
     }
 
     MemoryObject ExecContext::findNonStackObject(const MemoryEvent& memoryEvent)
     {
-        size_t size = memoryEvent.size;
+        size_t size = memoryEvent.access.size;
         void* addr = memoryEvent.addr;
         if (heapSupportEnabled)
         {
-            auto mo = heapInfo.findObject(memoryEvent);
+            auto mo = heapInfo.findObject(dbgCtxt, memoryEvent);
             if (!mo.isEmpty())
             {
                 return mo;
@@ -188,45 +199,48 @@ namespace pin
         return MemoryObject();
     }
 
-    MemoryObject ExecContext::findStackObject(const MemoryEvent& memoryEvent)
+    MemoryObject ExecContext::findStackObject(int threadId, const MemoryEvent& memoryEvent)
     {
-        size_t size = memoryEvent.size;
         void* addr = memoryEvent.addr;
-        int i = 0;
+        auto& calls = callStackGlobal.getCalls(threadId);
+        //the stack grows down, so frame bases decrease from the outermost call:
+        //frames above the address are skipped by a binary search
+        auto it = std::partition_point(calls.begin(), calls.end(),
+                                       [addr](const FuncCall& call) { return addr <= call.frameBase; });
+        for (int i = (int)(it - calls.begin()) - 1; i >= 0; i--)
         {
+            auto& call = calls[i];
+            auto* var = call.funcInfo->findLocal((char*)addr - (char*)call.frameBase);
+            if (var)
             {
-                auto& calls = callStackGlobal.getCalls(i);
-                //cout << "findStackObject " << calls.size() << endl;
-                for (int i = calls.size() - 1; i >= 0; i--)
-                {
-                    auto& call = calls[i];
-                    if (addr <= call.frameBase)
-                    {
-                        for (auto& var : call.funcInfo->vars)
-                        {
-                            char* varAddr = (char*)call.frameBase + var->stackOffset;
-                            if (varAddr <= addr && addr <= varAddr + var->size - 1)
-                            {
-                                //cout << "found object: " << var->name << endl;
-                                /*if (!((char*)addr + size <= varAddr + var->size))
-                                {
-                                    std::cout << var->name << std::endl;
-                                    std::cout << addr << std::endl;
-                                    std::cout << size << std::endl;
-                                    std::cout << varAddr << std::endl;
-                                    std::cout << var->size << std::endl;
-                                }*/
-                                //assert((char*)addr + size <= varAddr + var->size);
-                                return MemoryObject(varAddr, var->size, var);
-                            }
-                        }
-                    }
-                }
+                return MemoryObject((char*)call.frameBase + var->stackOffset, var->size, var);
             }
         }
         return MemoryObject();
     }
 
+    int ExecContext::findStackOwner(int threadId, void* addr) const
+    {
+        if (stackRanges[threadId].contains(addr))
+        {
+            return threadId;
+        }
+        //call stacks of other threads are changed by them while resolving online
+        if (onlineResolution)
+        {
+            return -1;
+        }
+        //e.g. shared variables of an OpenMP region on the stack of the master thread
+        for (int i = 0; i < rangeCount; i++)
+        {
+            if (stackRanges[i].contains(addr))
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
     int ExecContext::getRoutineId(RTN rtn)
     {
         string name = RTN_Name(rtn);
@@ -241,7 +255,72 @@ namespace pin
         return func->id;
     }
 
+    //the source line of an instruction is looked up once, when it is first instrumented
+    uint32_t ExecContext::getInstId(INS ins)
+    {
+        uint32_t instId = dbgCtxt.addInst(INS_Address(ins));
+        if (!dbgCtxt.hasInstSourceLocation(instId))
+        {
+            if (auto sourceLoc = getSourceLocationLocked(INS_Address(ins)))
+            {
+                dbgCtxt.setInstSourceLocation(instId, sourceLoc);
+            }
+        }
+        return instId;
+    }
+
+    const dbginfo::VarInfo* ExecContext::bindStaticAccess(uint32_t instId, ADDRINT addr)
+    {
+        auto* varInfo = dbgCtxt.findVarByAddress((void*)addr);
+        if (varInfo)
+        {
+            if (staticAccesses.size() <= instId)
+            {
+                staticAccesses.resize(instId + 1);
+            }
+            staticAccesses[instId].addr = addr;
+            staticAccesses[instId].varId = varInfo->id;
+        }
+        return varInfo;
+    }
+
+    void ExecContext::startThread(THREADID threadId, ADDRINT stackPointer, size_t stackSize)
+    {
+        //the page of the initial stack pointer holds the outermost frame
+        const ADDRINT pageSize = 4096;
+        StackRange& range = stackRanges[threadId];
+        range.hi = (stackPointer | (pageSize - 1)) + 1;
+        range.lo = stackPointer > stackSize ? stackPointer - stackSize : 0;
+        rangeCount = std::max(rangeCount, (int)threadId + 1);
+        eventDumper.startThread(threadId);
+    }
+
+    void ExecContext::finishThread(THREADID threadId)
+    {
+        if (profileMode)
+        {
+            finishProfile(threadId);
+        }
+    }
+
     void ExecContext::addEvent(const Event& event)
+    {
+        if (onlineResolution && isHeapEvent(event))
+        {
+            //accesses recorded before see the heap as it was then
+            if (event.type != EventType::CallInst)
+            {
+                resolveEvents(event.getThreadId(), eventDumper.getFilled(event.getThreadId()));
+            }
+            Event resolved = event;
+            handleHeapEvent(resolved);
+            recordEvent(resolved);
+            return;
+        }
+        recordEvent(event);
+    }
+
+    void ExecContext::recordEvent(const Event& event)
     {
         if (event.type == EventType::Call || event.type == EventType::Ret)
         {
@@ -252,48 +331,216 @@ namespace pin
                 if (event.type == EventType::Call)
                 {
                     //std::cout << "PROFILING STARTED" << std::endl;
-                    profilingEnabled = true;
+                    eventDumper.startRecording(event.getTime());
                 }
                 else if (event.type == EventType::Ret)
                 {
                     //dirty hack
-                    eventDumper.addEvent(event);
+                    if (eventDumper.addEvent(event))
+                    {
+                        flushEvents(event.getThreadId());
+                    }
                     Fini(0, nullptr);
                     exit(0);
                 }
             }
         }
-        if (profilingEnabled)
+        if (eventDumper.isRecording() && eventDumper.addEvent(event))
         {
-            eventDumper.addEvent(event);
+            flushEvents(event.getThreadId());
         }
     }
 
-    MemoryObject ExecContext::findObject(const MemoryEvent& memoryEvent)
+    EventBuffer* ExecContext::getEventBuffers()
     {
-        MemoryObject mo;
-        if (memoryEvent.addr > (void*)0x70000000000)
+        return eventDumper.getBuffers();
+    }
+
+    void ExecContext::flushEvents(THREADID threadId, UINT32 reserved)
+    {
+        if (onlineResolution)
+        {
+            resolveEvents(threadId, eventDumper.getFilled(threadId) - reserved);
+        }
+        resolvedCounts[threadId] = 0;
+        if (profileMode)
+        {
+            eventDumper.discard(threadId, reserved);
+            return;
+        }
+        eventDumper.flush(threadId, reserved);
+    }
+
+    void ExecContext::enableRegions()
+    {
+        regionMode = true;
+        for (int i = 0; i < MAX_THREADS; i++)
         {
-            mo = findStackObject(memoryEvent);
+            getEventBuffers()[i].recording = 0;
+        }
+    }
+
+    bool ExecContext::recordsAccesses() const
+    {
+        return !regionMode || openRegionCount > 0;
+    }
+
+    bool ExecContext::beginRegion(THREADID threadId, const std::string& name)
+    {
+        openRegions[threadId].push_back(regions.size());
+        regions.push_back(Region(name, threadId, Event::now()));
+        getEventBuffers()[threadId].recording = 1;
+        return ++openRegionCount == 1;
+    }
+
+    bool ExecContext::endRegion(THREADID threadId)
+    {
+        auto& open = openRegions[threadId];
+        if (open.empty())
+        {
+            return false;
+        }
+        regions[open.back()].end = Event::now();
+        open.pop_back();
+        getEventBuffers()[threadId].recording = !open.empty();
+        return --openRegionCount == 0;
+    }
+
+    bool ExecContext::isHeapEvent(const Event& event)
+    {
+        return event.type == EventType::Alloc || event.type == EventType::Free || event.type == EventType::CallInst;
+    }
+
+    void ExecContext::handleHeapEvent(Event& event)
+    {
+        int threadId = event.getThreadId();
+        switch (event.type)
+        {
+            case EventType::Alloc:
+            {
+                if (heapSupportEnabled)
+                {
+                    PIN_RWMutexWriteLock(&heapLock);
+                    //the table of instructions grows under the client lock
+                    PIN_LockClient();
+                    auto sourceLoc = dbgCtxt.getInstSourceLocation(callInsts[threadId]);
+                    PIN_UnlockClient();
+                    heapInfo.handleAlloc(dbgCtxt, event.memoryEvent, sourceLoc);
+                    PIN_RWMutexUnlock(&heapLock);
+                }
+                break;
+            }
+            case EventType::Free:
+            {
+                if (heapSupportEnabled)
+                {
+                    PIN_RWMutexWriteLock(&heapLock);
+                    heapInfo.handleFree(dbgCtxt, event.memoryEvent);
+                    PIN_RWMutexUnlock(&heapLock);
+                }
+                break;
+            }
+            //call instruction calling malloc gives the source location of the allocation
+            case EventType::CallInst:
+            {
+                callInsts[threadId] = event.routineEvent.instId;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void ExecContext::resolveAccess(int threadId, MemoryEvent& memoryEvent)
+    {
+        //resolved at instrumentation
+        if (memoryEvent.varId >= 0)
+        {
+            return;
+        }
+        auto mo = findObject(threadId, memoryEvent);
+        if (!mo.isEmpty())
+        {
+            memoryEvent.varId = mo.varInfo->id;
         }
         else
         {
-            mo = findNonStackObject(memoryEvent);
+            memoryEvent.varId = -1;
         }
-        return mo;
+    }
+
+    void ExecContext::resolveEvents(int threadId, size_t count)
+    {
+        //events of the thread are in order, its call stack is replayed up to the last one
+        Event* events = eventDumper.getBlock(threadId);
+        uint64_t recordingStart = eventDumper.getRecordingStart();
+        PIN_RWMutexReadLock(&heapLock);
+        for (size_t i = resolvedCounts[threadId]; i < count; i++)
+        {
+            Event& e = events[i];
+            if (e.type == EventType::Read || e.type == EventType::Write)
+            {
+                resolveAccess(threadId, e.memoryEvent);
+                if (profileMode && e.t >= recordingStart)
+                {
+                    auto& calls = callStackGlobal.getCalls(threadId);
+                    threadProfiles[threadId].addAccess(e, calls.empty() ? -1 : calls.back().funcInfo->id);
+                }
+            }
+            else
+            {
+                callStackGlobal.handleEvent(e, dbgCtxt);
+            }
+        }
+        PIN_RWMutexUnlock(&heapLock);
+        resolvedCounts[threadId] = std::max(resolvedCounts[threadId], count);
+    }
+
+    void ExecContext::finishProfile(int threadId)
+    {
+        resolveEvents(threadId, eventDumper.getFilled(threadId));
+        resolvedCounts[threadId] = 0;
+        eventDumper.discard(threadId);
+        profile.merge(threadProfiles[threadId]);
+        threadProfiles[threadId] = Profile();
+    }
+
+    MemoryObject ExecContext::findObject(int threadId, const MemoryEvent& memoryEvent)
+    {
+        int owner = findStackOwner(threadId, memoryEvent.addr);
+        if (owner >= 0)
+        {
+            return findStackObject(owner, memoryEvent);
+        }
+        return findNonStackObject(memoryEvent);
     }
 
     EventManager ExecContext::dumpEvents()
     {
+        if (onlineResolution)
+        {
+            //only the events left in the buffers are resolved at exit
+            for (int threadId = 0; threadId < MAX_THREADS; threadId++)
+            {
+                resolveEvents(threadId, eventDumper.getFilled(threadId));
+            }
+            EventManager em = eventDumper.finalize(dbgCtxt);
+            em.setRegions(regions);
+            return em;
+        }
         EventManager em = eventDumper.finalize(dbgCtxt);
-        int processed = 0;
+        em.setRegions(regions);
+        em.enableWriteBack();
+        uint64_t processed = 0;
+        //report each percent instead of a fixed number of events to keep output short on huge traces
+        uint64_t reportStep = std::max<uint64_t>(em.size() / 100, 10000);
         double t_all = utils::dsecnd();
         double tt = 0;
-        std::vector<ADDRINT> callInstructions(MAX_THREADS);
+        std::vector<uint32_t> callInstructions(MAX_THREADS);
         while (em.hasNext())
         {
             processed++;
-            if (processed % 10000 == 0)
+            if (processed % reportStep == 0)
             {
                 std::cout << "Event postprocessing: " << processed * 100. / em.size() << "%" << " " << em.size() << std::endl;
             }
@@ -306,7 +553,7 @@ namespace pin
                 {
                     if (heapSupportEnabled)
                     {
-                        auto sourceLoc = getSourceLocation(callInstructions[e.memoryEvent.threadId]);
+                        auto sourceLoc = dbgCtxt.getInstSourceLocation(callInstructions[e.threadId]);
                         heapInfo.handleAlloc(dbgCtxt, e.memoryEvent, sourceLoc);
                     }
                     break;
@@ -323,7 +570,7 @@ namespace pin
                 case EventType::CallInst:
                 {
                     auto& re = e.routineEvent;
-                    callInstructions[e.routineEvent.threadId] = re.instAddr;
+                    callInstructions[e.threadId] = re.instId;
                     break;
                 }
                 case EventType::Call:
@@ -340,32 +587,23 @@ namespace pin
                     FuncCall funcCall(funcInfo, frameBase);
                     if (e.type == EventType::Call)
                     {
-                        callStackGlobal.push(e.routineEvent.threadId, funcCall);
+                        callStackGlobal.push(e.threadId, funcCall);
                     }
                     else
                     {
-                        callStackGlobal.pop(e.routineEvent.threadId, funcCall);
+                        callStackGlobal.pop(e.threadId, funcCall);
                     }
                     break;
                 }
                 case EventType::Read:
                 case EventType::Write:
                 {
-                    auto& memoryEvent = e.memoryEvent;
-                    auto mo = findObject(memoryEvent);
-                    if (!mo.isEmpty())
+                    uint32_t instId = e.getInstId();
+                    if (instId < staticAccesses.size() && staticAccesses[instId].addr == (ADDRINT)e.memoryEvent.addr)
                     {
-                        memoryEvent.varId = mo.varInfo->id;
-                        if (auto sourceLoc = getSourceLocation(memoryEvent.instAddr))
-                        {
-                            dbgCtxt.setInstBinding(memoryEvent.instAddr, sourceLoc);
-                        }
-                        assert(mo.varInfo);
-                    }
-                    else
-                    {
-                        memoryEvent.varId = -1;
+                        e.memoryEvent.varId = staticAccesses[instId].varId;
                     }
+                    resolveAccess(e.threadId, e.memoryEvent);
                     break;
                 }
             }
@@ -373,4 +611,14 @@ namespace pin
         em.dump();
         return em;
     }
+
+    Profile ExecContext::dumpProfile()
+    {
+        //threads still running at exit
+        for (int threadId = 0; threadId < MAX_THREADS; threadId++)
+        {
+            finishProfile(threadId);
+        }
+        return profile;
+    }
 } //namespace pin
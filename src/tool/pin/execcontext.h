@@ -9,10 +9,12 @@
 #include "common/callstack.h"
 #include "common/debuginfo/debugcontext.h"
 #include "common/event/eventmanager.h"
+#include "common/event/profile.h"
 #include "common/sourcelocation.h"
 #include "common/utils.h"
 #include "pin.H"
 #include "pineventdumper.h"
+#include "tooloptions.h"
 
 namespace pin
 {
@@ -37,7 +39,26 @@ namespace pin
     public:
         void handleAlloc(dbginfo::DebugContext& dbgCtxt, MemoryEvent& memoryEvent, const SourceLocation& srcLoc);
         void handleFree(dbginfo::DebugContext& dbgCtxt, MemoryEvent& memoryEvent);
-        MemoryObject findObject(const MemoryEvent& memoryEvent) const;
+        MemoryObject findObject(const dbginfo::DebugContext& dbgCtxt, const MemoryEvent& memoryEvent) const;
+    };
+
+    //Addresses a thread stack can span, from its stack pointer at start down by the stack limit
+    struct StackRange
+    {
+        ADDRINT lo = 0;
+        ADDRINT hi = 0;
+
+        bool contains(void* addr) const
+        {
+            return lo <= (ADDRINT)addr && (ADDRINT)addr < hi;
+        }
+    };
+
+    //Global variable at the fixed address of a memory operand of an instruction
+    struct StaticAccess
+    {
+        ADDRINT addr = 0;
+        int varId = -1;
     };
 
     class ExecContext
@@ -49,18 +70,69 @@ namespace pin
         CallStackGlobal callStackGlobal;
 
         PinEventDumper eventDumper;
-        bool profilingEnabled = false;
-        bool heapSupportEnabled = false;
+        bool heapSupportEnabled;
+
+        //online resolution: heap events update the heap live, accesses are resolved
+        //by their thread when its buffer is flushed and before each of its heap events
+        bool onlineResolution;
+        PIN_RWMUTEX heapLock;
+        std::vector<uint32_t> callInsts;
+        //events at the start of the current buffer of each thread that are resolved
+        std::vector<size_t> resolvedCounts;
+        //set once by each thread when it starts
+        std::vector<StackRange> stackRanges;
+        //thread ids are given out in order, ranges above are unused
+        int rangeCount = 0;
+
+        //profile mode: each thread aggregates its resolved accesses, merged when it exits
+        bool profileMode;
+        std::vector<Profile> threadProfiles;
+        Profile profile;
+
+        //by instruction id, bound at instrumentation for the pass at exit: the trace doesn't keep varIds
+        std::vector<StaticAccess> staticAccesses;
+
+        //accesses are recorded only in regions if the program uses the ROI API
+        bool regionMode = false;
+        std::vector<Region> regions;
+        //regions are nested within a thread, by thread id
+        std::vector<std::vector<size_t>> openRegions;
+        //accesses are instrumented while any thread is in a region,
+        //each thread keeps them only while it's in one of its own
+        size_t openRegionCount = 0;
 
         MemoryObject findNonStackObject(const MemoryEvent& memoryEvent);
-        MemoryObject findStackObject(const MemoryEvent& memoryEvent);
+        MemoryObject findStackObject(int threadId, const MemoryEvent& memoryEvent);
+        //thread whose stack contains the address, -1 if none
+        int findStackOwner(int threadId, void* addr) const;
+        void recordEvent(const Event& event);
+        static bool isHeapEvent(const Event& event);
+        void handleHeapEvent(Event& event);
+        void resolveAccess(int threadId, MemoryEvent& memoryEvent);
+        void resolveEvents(int threadId, size_t count);
+        void finishProfile(int threadId);
 
     public:
-        ExecContext(const std::string& binPath, dbginfo::DebugContext& dbgCtxt);
+        ExecContext(const std::string& binPath, dbginfo::DebugContext& dbgCtxt, const ToolOptions& options);
         int getRoutineId(RTN rtn);
+        uint32_t getInstId(INS ins);
+        //variable at the fixed address of an operand of the instruction, null if none
+        const dbginfo::VarInfo* bindStaticAccess(uint32_t instId, ADDRINT addr);
+        void startThread(THREADID threadId, ADDRINT stackPointer, size_t stackSize);
+        //has to be called under a lock in the profile mode
+        void finishThread(THREADID threadId);
         void addEvent(const Event& event);
-        MemoryObject findObject(const MemoryEvent& memoryEvent);
+        EventBuffer* getEventBuffers();
+        void flushEvents(THREADID threadId, UINT32 reserved = 0);
+        MemoryObject findObject(int threadId, const MemoryEvent& memoryEvent);
+        void enableRegions();
+        //accesses are instrumented outside of regions only without the ROI API
+        bool recordsAccesses() const;
+        //return true if accesses start or stop being recorded
+        bool beginRegion(THREADID threadId, const std::string& name);
+        bool endRegion(THREADID threadId);
         EventManager dumpEvents();
+        Profile dumpProfile();
         void saveMemoryAccesses() const;
     };
 } //namespace pin
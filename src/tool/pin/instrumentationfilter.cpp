@@ -0,0 +1,85 @@
+#include "instrumentationfilter.h"
+
+namespace pin
+{
+    bool InstrumentationFilter::matches(const std::vector<std::regex>& patterns, const std::string& s)
+    {
+        for (auto& pattern: patterns)
+        {
+            if (std::regex_match(s, pattern))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool InstrumentationFilter::matchesFile(const std::vector<std::regex>& patterns, const std::string& fileName)
+    {
+        auto pos = fileName.rfind('/');
+        std::string baseName = pos == std::string::npos ? fileName : fileName.substr(pos + 1);
+        return matches(patterns, fileName) || matches(patterns, baseName);
+    }
+
+    void InstrumentationFilter::includeFunc(const std::string& pattern)
+    {
+        includeFuncs.emplace_back(pattern);
+    }
+
+    void InstrumentationFilter::excludeFunc(const std::string& pattern)
+    {
+        excludeFuncs.emplace_back(pattern);
+    }
+
+    void InstrumentationFilter::includeFile(const std::string& pattern)
+    {
+        includeFiles.emplace_back(pattern);
+    }
+
+    void InstrumentationFilter::excludeFile(const std::string& pattern)
+    {
+        excludeFiles.emplace_back(pattern);
+    }
+
+    void InstrumentationFilter::includeVar(const std::string& pattern)
+    {
+        includeVars.emplace_back(pattern);
+    }
+
+    void InstrumentationFilter::excludeVar(const std::string& pattern)
+    {
+        excludeVars.emplace_back(pattern);
+    }
+
+    bool InstrumentationFilter::isEmpty() const
+    {
+        return includeFuncs.empty() && excludeFuncs.empty() && includeFiles.empty() && excludeFiles.empty();
+    }
+
+    bool InstrumentationFilter::accepts(const std::string& funcName, const std::string& fileName) const
+    {
+        if (matches(excludeFuncs, funcName) || matchesFile(excludeFiles, fileName))
+        {
+            return false;
+        }
+        if (includeFuncs.empty() && includeFiles.empty())
+        {
+            return true;
+        }
+        return matches(includeFuncs, funcName) || matchesFile(includeFiles, fileName);
+    }
+
+    bool InstrumentationFilter::filtersVars() const
+    {
+        return !includeVars.empty() || !excludeVars.empty();
+    }
+
+    bool InstrumentationFilter::acceptsVar(const std::string& varName) const
+    {
+        if (matches(excludeVars, varName))
+        {
+            return false;
+        }
+        return includeVars.empty() || matches(includeVars, varName);
+    }
+} //namespace pin
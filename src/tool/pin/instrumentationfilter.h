@@ -0,0 +1,39 @@
+#pragma once
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace pin
+{
+    //Selects routines whose memory accesses are instrumented.
+    //Patterns are regular expressions matched against the whole routine name
+    //or against the path or the base name of the source file of the routine.
+    //Variable patterns select global variables by name, they apply to accesses
+    //whose variable is known at instrumentation (addressed relative to the instruction pointer).
+    class InstrumentationFilter
+    {
+        std::vector<std::regex> includeFuncs;
+        std::vector<std::regex> excludeFuncs;
+        std::vector<std::regex> includeFiles;
+        std::vector<std::regex> excludeFiles;
+        std::vector<std::regex> includeVars;
+        std::vector<std::regex> excludeVars;
+
+        static bool matches(const std::vector<std::regex>& patterns, const std::string& s);
+        static bool matchesFile(const std::vector<std::regex>& patterns, const std::string& fileName);
+
+    public:
+        void includeFunc(const std::string& pattern);
+        void excludeFunc(const std::string& pattern);
+        void includeFile(const std::string& pattern);
+        void excludeFile(const std::string& pattern);
+        void includeVar(const std::string& pattern);
+        void excludeVar(const std::string& pattern);
+        //no routine patterns
+        bool isEmpty() const;
+        bool filtersVars() const;
+        //a routine is accepted if it matches an include pattern (or there are none) and no exclude one
+        bool accepts(const std::string& funcName, const std::string& fileName) const;
+        bool acceptsVar(const std::string& varName) const;
+    };
+} //namespace pin
@@ -1,77 +1,345 @@
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <sys/stat.h>
+#include "common/event/tracestream.h"
 #include "common/utils.h"
 #include "config.h"
 #include "pineventdumper.h"
 
 namespace pin
 {
-    int PinEventDumper::EventBlockSize = 1 << 23;
+    //------------------------------------------------------------------------------
+    //BufferPool
+    //------------------------------------------------------------------------------
 
-    PinEventDumper::PinEventDumper(const std::string& eventPath) :
-        eventPath(eventPath),
-        pEventsMain(&events0),
-        pEventsSave(&events1)
+    BufferPool::BufferPool(size_t blockSize, size_t spareCount, size_t maxCount) :
+        blockSize(blockSize),
+        buffers(maxCount),
+        size(0),
+        next(maxCount, NoBuffer),
+        head(NoBuffer)
+    {
+        PIN_SemaphoreInit(&released);
+        for (size_t i = 0; i < spareCount; i++)
+        {
+            release(add());
+        }
+    }
+
+    uint32_t BufferPool::add()
+    {
+        uint32_t buffer = size++;
+        assert(buffer < buffers.size());
+        //slots of a thread outside of regions may pass the end
+        buffers[buffer].reset(new Event[blockSize + EventBuffer::MaxReserved]);
+        return buffer;
+    }
+
+    bool BufferPool::tryAcquire(uint32_t& buffer)
+    {
+        uint64_t oldHead = head.load();
+        for (;;)
+        {
+            buffer = (uint32_t)oldHead;
+            if (buffer == NoBuffer)
+            {
+                return false;
+            }
+            uint64_t newHead = ((oldHead >> 32) + 1) << 32 | next[buffer];
+            if (head.compare_exchange_weak(oldHead, newHead))
+            {
+                return true;
+            }
+        }
+    }
+
+    uint32_t BufferPool::acquire(double& stallTime)
+    {
+        uint32_t buffer;
+        if (tryAcquire(buffer))
+        {
+            return buffer;
+        }
+        double t = utils::dsecnd();
+        //timed, a release may come between the check and the wait
+        while (!tryAcquire(buffer))
+        {
+            PIN_SemaphoreTimedWait(&released, 1);
+            PIN_SemaphoreClear(&released);
+        }
+        stallTime += utils::dsecnd() - t;
+        return buffer;
+    }
+
+    void BufferPool::release(uint32_t buffer)
+    {
+        uint64_t oldHead = head.load();
+        for (;;)
+        {
+            next[buffer] = (uint32_t)oldHead;
+            uint64_t newHead = ((oldHead >> 32) + 1) << 32 | buffer;
+            if (head.compare_exchange_weak(oldHead, newHead))
+            {
+                break;
+            }
+        }
+        PIN_SemaphoreSet(&released);
+    }
+
+    size_t BufferPool::getMaxCount() const
+    {
+        return buffers.size();
+    }
+
+    //------------------------------------------------------------------------------
+    //PinEventDumper
+    //------------------------------------------------------------------------------
+
+    PinEventDumper::PinEventDumper(const dbginfo::DebugContext& dbgCtxt, const ToolOptions& options) :
+        dbgCtxt(dbgCtxt),
+        eventPath(options.eventPath),
+        blockSize(options.blockSize),
+        codec(options.codec),
+        compressionLevel(options.compressionLevel),
+        onlineResolution(options.onlineResolution),
+        writesTrace(!options.profile),
+        sampling(options.sampling),
+        pool(options.blockSize, options.spareBuffers, options.spareBuffers + MAX_THREADS),
+        shards(MAX_THREADS, nullptr),
+        shardKey(PIN_CreateThreadDataKey(nullptr)),
+        buffers(MAX_THREADS),
+        stallMicroseconds(0),
+        stalls(0),
+        queued(0),
+        queuedSum(0),
+        queuedMax(0),
+        submits(0)
     {
-        std::remove(eventPath.c_str());
-        PIN_SemaphoreInit(&saved);
         PIN_SemaphoreInit(&filled);
-        PIN_SemaphoreSet(&saved);
+        PIN_SemaphoreInit(&done);
         PIN_SpawnInternalThread(threadFunc, this, 0, nullptr);
     }
 
+    PinEventDumper::Shard* PinEventDumper::createShard(int threadId)
+    {
+        Shard* shard = new Shard();
+        shard->current = pool.add();
+        //every buffer of the pool may wait in a single shard
+        shard->queue.resize(pool.getMaxCount());
+        shard->queueHead = 0;
+        shard->queueTail = 0;
+        buffers[threadId].cursor = pool.get(shard->current);
+        buffers[threadId].end = buffers[threadId].cursor + blockSize;
+        if (writesTrace)
+        {
+            shard->writer.setCompression(codec, compressionLevel);
+            shard->writer.setSampling(sampling);
+            std::string path = EventManager::shardPath(eventPath, threadId);
+            bool opened = shard->writer.open(path, dbgCtxt);
+            assert(opened);
+            if (onlineResolution)
+            {
+                shard->annotations.setCompression(codec, compressionLevel);
+                opened = shard->annotations.open(TraceStream::annotationPath(path));
+                assert(opened);
+            }
+        }
+        //published only when complete, the writer thread scans shards without a lock
+        shards[threadId] = shard;
+        PIN_SetThreadData(shardKey, shard, threadId);
+        return shard;
+    }
+
+    void PinEventDumper::startThread(THREADID threadId)
+    {
+        assert(threadId < (THREADID)MAX_THREADS);
+        if (!shards[threadId])
+        {
+            createShard(threadId);
+        }
+    }
+
     void PinEventDumper::threadFunc(void* arg)
     {
         PinEventDumper* eventDumper = (PinEventDumper*)arg;
         for(;;)
         {
-            //std::cout << "thread: wait filled" << std::endl;
             PIN_SemaphoreWait(&eventDumper->filled);
-            //std::cout << "thread: clear filled" << std::endl;
             PIN_SemaphoreClear(&eventDumper->filled);
-            std::ofstream out(eventDumper->eventPath, ios::app | ios::binary);
-            assert(out.good());
-            out.write((char*)&(*eventDumper->pEventsSave)[0], eventDumper->pEventsSave->size() * sizeof(Event));
-            std::cout << "EVENTS SAVED: " << eventDumper->pEventsSave->size() << " : "
-                      << eventDumper->pEventsSave->size() * sizeof(Event) << std::endl;
-            eventDumper->totalEvents += eventDumper->pEventsSave->size();
-            eventDumper->pEventsSave->clear();
-            eventDumper->pEventsSave->shrink_to_fit();
-            //std::cout << "thread: set saved" << std::endl;
-            PIN_SemaphoreSet(&eventDumper->saved);
-            if (eventDumper->finished)
+            //read before the scan: buffers submitted before finishing must be written
+            bool finished = eventDumper->finished;
+            for (Shard* shard: eventDumper->shards)
             {
+                if (!shard)
+                {
+                    continue;
+                }
+                //buffers of a shard are written in the order of submission
+                while (shard->queueHead.load() != shard->queueTail.load(std::memory_order_acquire))
+                {
+                    size_t head = shard->queueHead.load();
+                    Submitted submitted = shard->queue[head % shard->queue.size()];
+                    eventDumper->save(*shard, submitted);
+                    shard->queueHead.store(head + 1, std::memory_order_release);
+                    eventDumper->queued--;
+                    eventDumper->pool.release(submitted.buffer);
+                }
+            }
+            if (finished)
+            {
+                PIN_SemaphoreSet(&eventDumper->done);
                 return;
             }
         }
     }
 
-    void PinEventDumper::addEvent(const Event& event)
+    void PinEventDumper::save(Shard& shard, const Submitted& submitted)
     {
-        pEventsMain->push_back(event);
-        if (pEventsMain->size() > EventBlockSize)
+        //events are ordered within a shard, only the first blocks can start before main
+        const Event* events = pool.get(submitted.buffer);
+        size_t count = submitted.count;
+        while (count > 0 && events->t < recordingStart)
         {
-            auto t = utils::rdtsc();
-            PIN_SemaphoreWait(&saved);
-            PIN_SemaphoreClear(&saved);
+            events++;
+            count--;
+        }
+        shard.writer.writeBlock(events, count);
+        if (shard.annotations.isOpen())
+        {
+            shard.annotations.writeBlock(events, count);
+        }
+        totalEvents += count;
+    }
 
-            std::swap(pEventsMain, pEventsSave);
+    //queues the current buffer of the thread for the writer, the thread continues in a free one
+    void PinEventDumper::submit(Shard& shard, size_t count)
+    {
+        size_t tail = shard.queueTail.load();
+        assert(tail - shard.queueHead.load(std::memory_order_acquire) < shard.queue.size());
+        shard.queue[tail % shard.queue.size()] = Submitted{shard.current, (uint32_t)count};
+        shard.queueTail.store(tail + 1, std::memory_order_release);
 
-            PIN_SemaphoreSet(&filled);
-            std::cout << "SCHEDULED TO SAVE: " << utils::rdtsc() - t << std::endl;
+        uint64_t depth = ++queued;
+        queuedSum += depth;
+        submits++;
+        uint64_t maxDepth = queuedMax.load();
+        while (depth > maxDepth && !queuedMax.compare_exchange_weak(maxDepth, depth))
+        {
         }
+        PIN_SemaphoreSet(&filled);
+    }
+
+    void PinEventDumper::startRecording(uint64_t t)
+    {
+        recordingStart = t;
+    }
+
+    bool PinEventDumper::isRecording() const
+    {
+        return recordingStart != UINT64_MAX;
+    }
+
+    uint64_t PinEventDumper::getRecordingStart() const
+    {
+        return recordingStart;
+    }
+
+    EventBuffer* PinEventDumper::getBuffers()
+    {
+        return buffers.data();
+    }
+
+    Event* PinEventDumper::getBlock(THREADID threadId)
+    {
+        return shards[threadId] ? pool.get(shards[threadId]->current) : nullptr;
+    }
+
+    size_t PinEventDumper::getFilled(THREADID threadId)
+    {
+        return shards[threadId] ? buffers[threadId].cursor - pool.get(shards[threadId]->current) : 0;
+    }
+
+    void PinEventDumper::flush(THREADID threadId, UINT32 reserved)
+    {
+        Shard* shard = (Shard*)PIN_GetThreadData(shardKey, threadId);
+        EventBuffer& buffer = buffers[threadId];
+        submit(*shard, buffer.cursor - reserved - pool.get(shard->current));
+        double stallTime = 0;
+        shard->current = pool.acquire(stallTime);
+        if (stallTime > 0)
+        {
+            stalls++;
+            stallMicroseconds += (uint64_t)(stallTime * 1e6);
+        }
+        buffer.slots = pool.get(shard->current);
+        buffer.cursor = buffer.slots + reserved;
+        buffer.end = buffer.slots + blockSize;
+    }
+
+    void PinEventDumper::discard(THREADID threadId, UINT32 reserved)
+    {
+        EventBuffer& buffer = buffers[threadId];
+        buffer.slots = getBlock(threadId);
+        buffer.cursor = buffer.slots + reserved;
+    }
+
+    bool PinEventDumper::addEvent(const Event& event)
+    {
+        //only the thread itself creates and fills its shard
+        int threadId = event.getThreadId();
+        if (!PIN_GetThreadData(shardKey, threadId))
+        {
+            createShard(threadId);
+        }
+        EventBuffer& buffer = buffers[threadId];
+        *buffer.cursor++ = event;
+        return buffer.cursor == buffer.end;
+    }
+
+    void PinEventDumper::printMetrics() const
+    {
+        std::cout << "[INFO] threads waited for a free buffer " << stalls << " times, "
+                  << stallMicroseconds / 1e6 << " s" << std::endl;
+        std::cout << "[INFO] buffers queued for the writer: "
+                  << (submits ? (double)queuedSum / submits : 0) << " on average, " << queuedMax << " at most" << std::endl;
+        std::cout << "[INFO] events saved: " << totalEvents << ", " << traceBytes << " bytes on disk" << std::endl;
     }
 
     EventManager PinEventDumper::finalize(const dbginfo::DebugContext& dbgCtxt)
     {
-        PIN_SemaphoreWait(&saved);
-        PIN_SemaphoreClear(&saved);
-        std::swap(pEventsMain, pEventsSave);
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            if (shards[i])
+            {
+                submit(*shards[i], getFilled(i));
+            }
+        }
         finished = true;
         PIN_SemaphoreSet(&filled);
-        PIN_SemaphoreWait(&saved);
-        return EventManager(dbgCtxt, eventPath, totalEvents);
+        PIN_SemaphoreWait(&done);
+
+        std::vector<int> shardThreads;
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            if (shards[i])
+            {
+                shards[i]->writer.close();
+                struct stat st;
+                int ret = stat(EventManager::shardPath(eventPath, i).c_str(), &st);
+                assert(ret == 0);
+                traceBytes += st.st_size;
+                if (shards[i]->annotations.isOpen())
+                {
+                    shards[i]->annotations.close(st.st_size);
+                }
+                delete shards[i];
+                shards[i] = nullptr;
+                shardThreads.push_back(i);
+            }
+        }
+        printMetrics();
+        return EventManager(dbgCtxt, eventPath, totalEvents, shardThreads);
     }
 
 } //namespace pin
@@ -1,32 +1,183 @@
 #pragma once
+#include <atomic>
+#include <memory>
 #include <vector>
 #include "pin.H"
 #include "debuginfo/debugcontext.h"
+#include "common/event/annotation.h"
 #include "common/event/eventmanager.h"
+#include "common/event/tracewriter.h"
 #include "config.h"
+#include "tooloptions.h"
 
 namespace pin
 {
+    //Write position of a thread in its current buffer, kept in a plain array so that
+    //the analysis routines filling it stay small enough for Pin to inline
+    struct EventBuffer
+    {
+        //upper bound of a reservation, blocks must be larger
+        static const UINT32 MaxReserved = 256;
+
+        Event* cursor = nullptr;
+        Event* end = nullptr;
+        //start of the last reservation
+        Event* slots = nullptr;
+        //position of the thread in the burst sampling period
+        UINT32 burstPosition = 0;
+        //0 while the thread is outside of the regions of the ROI API: its accesses are
+        //written at the cursor without moving it, so the analysis routines stay branch free
+        UINT32 recording = 1;
+
+        //varId is -1 unless the variable is known at instrumentation
+        static void setAccess(Event& e, EventType type, THREADID threadId, void* addr, UINT32 size, UINT32 instId,
+                              INT32 varId)
+        {
+            e.t = Event::now();
+            e.threadId = threadId;
+            e.type = type;
+            e.memoryEvent.addr = addr;
+            e.memoryEvent.access.size = size;
+            e.memoryEvent.access.instId = instId;
+            e.memoryEvent.varId = varId;
+        }
+
+        //returns true if the buffer has to be flushed
+        bool addAccess(EventType type, THREADID threadId, void* addr, UINT32 size, UINT32 instId, INT32 varId)
+        {
+            setAccess(*cursor, type, threadId, addr, size, instId, varId);
+            cursor += recording;
+            return cursor == end;
+        }
+
+        //makes room for count accesses written later by setSlot,
+        //returns true if they don't fit and the buffer has to be flushed first.
+        //Buffers have MaxReserved spare events for slots that aren't kept
+        bool reserve(UINT32 count)
+        {
+            slots = cursor;
+            cursor += count * recording;
+            return cursor >= end;
+        }
+
+        void setSlot(UINT32 slot, EventType type, THREADID threadId, void* addr, UINT32 size, UINT32 instId,
+                     INT32 varId)
+        {
+            setAccess(slots[slot], type, threadId, addr, size, instId, varId);
+        }
+    };
+
+    //Event buffers shared by all threads: spare ones are allocated at startup, one more
+    //when a thread starts. Free buffers are kept in a lock-free stack
+    class BufferPool
+    {
+        static const uint32_t NoBuffer = UINT32_MAX;
+
+        size_t blockSize;
+        std::vector<std::unique_ptr<Event[]>> buffers;
+        std::atomic<uint32_t> size;
+        //links of the free stack, head packs an ABA tag above the index
+        std::vector<uint32_t> next;
+        std::atomic<uint64_t> head;
+        PIN_SEMAPHORE released;
+
+        bool tryAcquire(uint32_t& buffer);
+
+    public:
+        BufferPool(size_t blockSize, size_t spareCount, size_t maxCount);
+        //allocates a buffer for the caller, the pool takes it back on release
+        uint32_t add();
+        //waits until a buffer is free, the wait is added to stallTime
+        uint32_t acquire(double& stallTime);
+        void release(uint32_t buffer);
+        size_t getMaxCount() const;
+
+        Event* get(uint32_t buffer) const
+        {
+            return buffers[buffer].get();
+        }
+    };
+
+    //Each application thread fills its own buffers and trace shard without a lock,
+    //a single internal thread compresses and writes full buffers of all shards
     class PinEventDumper
     {
-        static int EventBlockSize;
+        //full buffer waiting for the writer
+        struct Submitted
+        {
+            uint32_t buffer;
+            uint32_t count;
+        };
+
+        struct Shard
+        {
+            TraceWriter writer;
+            //varIds resolved at capture time, written only in online resolution mode
+            AnnotationWriter annotations;
+            //buffer being filled by the thread, its filled part ends at the cursor
+            uint32_t current;
+            //single producer (the thread) single consumer (the writer) ring
+            std::vector<Submitted> queue;
+            std::atomic<size_t> queueHead;
+            std::atomic<size_t> queueTail;
+        };
 
+        const dbginfo::DebugContext& dbgCtxt;
         std::string eventPath;
-        std::vector<Event> events0;
-        std::vector<Event> events1;
-        std::vector<Event>* pEventsMain;
-        std::vector<Event>* pEventsSave;
+        size_t blockSize;
+        trace::Codec codec;
+        int compressionLevel;
+        bool onlineResolution;
+        //shards don't write files in the profile mode, buffers are reused by their threads
+        bool writesTrace;
+        trace::Sampling sampling;
+        BufferPool pool;
+        //indexed by thread id for the writer, each thread finds its own shard in TLS
+        std::vector<Shard*> shards;
+        TLS_KEY shardKey;
+        std::vector<EventBuffer> buffers;
+        //events before main are dropped by the writer thread
+        volatile uint64_t recordingStart = UINT64_MAX;
+
+        //reported at exit
+        std::atomic<uint64_t> stallMicroseconds;
+        std::atomic<uint64_t> stalls;
+        std::atomic<uint64_t> queued;
+        std::atomic<uint64_t> queuedSum;
+        std::atomic<uint64_t> queuedMax;
+        std::atomic<uint64_t> submits;
+        //size of the closed shards, blocks may be compressed
+        uint64_t traceBytes = 0;
 
         volatile bool finished = false;
-        PIN_SEMAPHORE saved;
         PIN_SEMAPHORE filled;
+        PIN_SEMAPHORE done;
+
+        Shard* createShard(int threadId);
+        void submit(Shard& shard, size_t count);
+        void save(Shard& shard, const Submitted& submitted);
+        void printMetrics() const;
 
     public:
-        int totalEvents = 0;
+        uint64_t totalEvents = 0;
 
-        PinEventDumper(const std::string& eventPath = BIN_EVENT_PATH);
+        PinEventDumper(const dbginfo::DebugContext& dbgCtxt, const ToolOptions& options);
         static void threadFunc(void* arg);
-        void addEvent(const Event& event);
+        void startThread(THREADID threadId);
+        void startRecording(uint64_t t);
+        bool isRecording() const;
+        //events before are dropped
+        uint64_t getRecordingStart() const;
+        EventBuffer* getBuffers();
+        //filled part of the current buffer of a thread
+        Event* getBlock(THREADID threadId);
+        size_t getFilled(THREADID threadId);
+        //called by the thread when its buffer is full, the last reserved events move to the next buffer
+        void flush(THREADID threadId, UINT32 reserved = 0);
+        //like flush, but the events are dropped and the thread keeps its buffer
+        void discard(THREADID threadId, UINT32 reserved = 0);
+        //returns true if the buffer of the thread is full and has to be flushed
+        bool addEvent(const Event& event);
         EventManager finalize(const dbginfo::DebugContext& dbgCtxt);
     };
 } //namespace pin
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <sys/mman.h>
 #include "pinhandler.h"
 #include "common/utils.h"
 using namespace std;
@@ -31,57 +33,153 @@ namespace pin
 
     namespace mem
     {
-        PIN_LOCK lock;
+        //allocators: the size is kept per thread until the allocator returns
+        static void allocBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, size_t size)
+        {
+            execHandler->handleAllocBefore(threadId, sp, size);
+        }
+
+        static void callocBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, size_t nmemb, size_t size)
+        {
+            execHandler->handleAllocBefore(threadId, sp, nmemb * size);
+        }
+
+        static void reallocBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, ADDRINT addr, size_t size)
+        {
+            execHandler->handleAllocBefore(threadId, sp, size, addr);
+        }
+
+        static void memalignBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, ADDRINT memptr, size_t size)
+        {
+            execHandler->handleAllocBefore(threadId, sp, size, memptr);
+        }
+
+        //only anonymous mappings are heap objects, thread stacks are found by stack ranges
+        static void mmapBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, size_t length, ADDRINT flags)
+        {
+            bool anonymous = (flags & MAP_ANONYMOUS) && !(flags & MAP_STACK);
+            execHandler->handleAllocBefore(threadId, sp, anonymous ? length : 0);
+        }
+
+        static void allocAfter(PinHandler* execHandler, THREADID threadId, ADDRINT addr)
+        {
+            execHandler->handleAllocAfter(threadId, (void*)addr);
+        }
 
-        //not thread safe
-        size_t mallocSizeRequested;
-        size_t callocSizeRequested;
+        static void reallocAfter(PinHandler* execHandler, THREADID threadId, ADDRINT addr)
+        {
+            execHandler->handleReallocAfter(threadId, (void*)addr);
+        }
+
+        //posix_memalign returns an error code and the address through its first argument
+        static void memalignAfter(PinHandler* execHandler, THREADID threadId, ADDRINT ret)
+        {
+            ADDRINT memptr = execHandler->getPendingArg(threadId);
+            execHandler->handleAllocAfter(threadId, ret == 0 && memptr ? *(void**)memptr : nullptr);
+        }
+
+        static void mmapAfter(PinHandler* execHandler, THREADID threadId, ADDRINT addr)
+        {
+            execHandler->handleAllocAfter(threadId, (void*)addr == MAP_FAILED ? nullptr : (void*)addr);
+        }
+
+        static void freeBefore(PinHandler* execHandler, THREADID threadId, ADDRINT sp, void* addr)
+        {
+            execHandler->handleFreeBefore(threadId, sp, addr);
+        }
+
+        static void freeAfter(PinHandler* execHandler, THREADID threadId)
+        {
+            execHandler->handleFreeAfter(threadId);
+        }
+
+        //accesses are appended by the inlined if part, the then part runs only on a full buffer
+        static ADDRINT PIN_FAST_ANALYSIS_CALL memoryRead(EventBuffer* buffers, THREADID threadId,
+                                                         UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
+        {
+            return buffers[threadId].addAccess(EventType::Read, threadId, addr, size, instId, varId);
+        }
 
-        static void mallocBefore(PinHandler* execHandler, THREADID threadId, size_t size)
+        static ADDRINT PIN_FAST_ANALYSIS_CALL memoryWrite(EventBuffer* buffers, THREADID threadId,
+                                                          UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
         {
-            Locker locker(&lock, threadId);
-            mallocSizeRequested = size;
+            return buffers[threadId].addAccess(EventType::Write, threadId, addr, size, instId, varId);
         }
 
-        static void mallocAfter(PinHandler* execHandler, THREADID threadId, void* addr)
+        static void PIN_FAST_ANALYSIS_CALL flush(PinHandler* execHandler, THREADID threadId)
         {
-            Locker locker(&lock, threadId);
-            if (!addr || mallocSizeRequested == 0)
+            execHandler->handleFullBuffer(threadId, 0);
+        }
+
+        //sampling: the inlined if part only decides, accesses are appended by the then part
+        static ADDRINT PIN_FAST_ANALYSIS_CALL sampleBurst(EventBuffer* buffers, THREADID threadId,
+                                                          UINT32 length, UINT32 period)
+        {
+            UINT32& position = buffers[threadId].burstPosition;
+            position = position + 1 == period ? 0 : position + 1;
+            return position < length;
+        }
+
+        //counters are shared by threads, a lost update only shifts the phase.
+        //A counter that racing threads took past zero is out of the period and starts over
+        static ADDRINT PIN_FAST_ANALYSIS_CALL sampleInst(UINT32* counter, UINT32 period)
+        {
+            UINT32 left = *counter - 1;
+            if (left - 1 < period - 1)
             {
-                return;
+                *counter = left;
+                return 0;
             }
-            execHandler->handleHeapAlloc(threadId, addr, mallocSizeRequested);
-            mallocSizeRequested = 0;
+            *counter = period;
+            return 1;
         }
 
-        static void callocBefore(PinHandler* execHandler, THREADID threadId, size_t nmemb, size_t size)
+        static ADDRINT PIN_FAST_ANALYSIS_CALL sampleBurstInst(EventBuffer* buffers, THREADID threadId,
+                                                              UINT32 length, UINT32 period,
+                                                              UINT32* counter, UINT32 instPeriod)
         {
-            Locker locker(&lock, threadId);
-            callocSizeRequested = nmemb*size;
+            return sampleBurst(buffers, threadId, length, period) && sampleInst(counter, instPeriod);
         }
 
-        static void callocAfter(PinHandler* execHandler, THREADID threadId, void* addr)
+        static void PIN_FAST_ANALYSIS_CALL recordRead(PinHandler* execHandler, EventBuffer* buffers, THREADID threadId,
+                                                      UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
         {
-            Locker locker(&lock, threadId);
-            if (!addr || callocSizeRequested == 0)
-                return;
-            execHandler->handleHeapAlloc(threadId, addr, callocSizeRequested);
-            callocSizeRequested = 0;
+            if (memoryRead(buffers, threadId, instId, addr, size, varId))
+            {
+                execHandler->handleFullBuffer(threadId, 0);
+            }
+        }
+
+        static void PIN_FAST_ANALYSIS_CALL recordWrite(PinHandler* execHandler, EventBuffer* buffers, THREADID threadId,
+                                                       UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
+        {
+            if (memoryWrite(buffers, threadId, instId, addr, size, varId))
+            {
+                execHandler->handleFullBuffer(threadId, 0);
+            }
         }
 
-        static void freeBefore(PinHandler* execHandler, THREADID threadId, void* addr)
+        //trace mode: a segment of a basic block reserves its accesses once and fills fixed slots
+        static ADDRINT PIN_FAST_ANALYSIS_CALL reserve(EventBuffer* buffers, THREADID threadId, UINT32 count)
         {
-            execHandler->handleHeapFree(threadId, addr);
+            return buffers[threadId].reserve(count);
         }
 
-        static void memoryRead(PinHandler* execHandler, VOID* ip, THREADID threadId, VOID* addr, UINT32 size)
+        static void PIN_FAST_ANALYSIS_CALL flushReserved(PinHandler* execHandler, THREADID threadId, UINT32 count)
         {
-            execHandler->handleMemoryRead(threadId, addr, size, ip);
+            execHandler->handleFullBuffer(threadId, count);
         }
 
-        static void memoryWrite(PinHandler* execHandler, VOID* ip, THREADID threadId, VOID* addr, UINT32 size)
+        static void PIN_FAST_ANALYSIS_CALL memoryReadSlot(EventBuffer* buffers, THREADID threadId, UINT32 slot,
+                                                          UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
         {
-            execHandler->handleMemoryWrite(threadId, addr, size, ip);
+            buffers[threadId].setSlot(slot, EventType::Read, threadId, addr, size, instId, varId);
+        }
+
+        static void PIN_FAST_ANALYSIS_CALL memoryWriteSlot(EventBuffer* buffers, THREADID threadId, UINT32 slot,
+                                                           UINT32 instId, VOID* addr, UINT32 size, INT32 varId)
+        {
+            buffers[threadId].setSlot(slot, EventType::Write, threadId, addr, size, instId, varId);
         }
     };
 
@@ -95,13 +193,23 @@ namespace pin
         execHandler->handleRoutineExit(ctxt, threadId, rtnId);
     }
 
-    static void callInstBefore(PinHandler* execHandler, THREADID threadId, ADDRINT instAddr, UINT32 rtnId)
+    static void regionBegin(PinHandler* execHandler, THREADID threadId, ADDRINT name)
+    {
+        execHandler->handleRegionBegin(threadId, (const char*)name);
+    }
+
+    static void regionEnd(PinHandler* execHandler, THREADID threadId)
+    {
+        execHandler->handleRegionEnd(threadId);
+    }
+
+    static void callInstBefore(PinHandler* execHandler, THREADID threadId, UINT32 instId, UINT32 rtnId)
     {
         //cout << "routineCallAnyBefore " << execHandler->routines[rtnId].name << endl;
-        execHandler->handleCallInst(instAddr, threadId, rtnId);
+        execHandler->handleCallInst(instId, threadId, rtnId);
     }
 
-    static void callInstAfter(PinHandler* execHandler, THREADID threadId, ADDRINT instAddr, UINT32 rtnId)
+    static void callInstAfter(PinHandler* execHandler, THREADID threadId, UINT32 instId, UINT32 rtnId)
     {
         //cout << "routineCall2After: " << execHandler->routines[rtnId].name << endl;
     }
@@ -110,53 +218,171 @@ namespace pin
     //PinHandler
     //------------------------------------------------------------------------------
 
-    PinHandler::PinHandler(const string& binPath, dbginfo::DebugContext& dbgCtxt) :
+    PinHandler::PinHandler(const string& binPath, dbginfo::DebugContext& dbgCtxt, const ToolOptions& options) :
         binPath(binPath),
-        execCtxt(binPath, dbgCtxt)
+        execCtxt(binPath, dbgCtxt, options),
+        sampling(options.sampling),
+        filter(options.filter),
+        filteredCalls(options.filteredCalls),
+        heapTracking(options.heapTracking),
+        pendingAllocs(MAX_THREADS)
     {
         PIN_InitLock(&lock);
     }
 
-    void PinHandler::handleHeapAlloc(THREADID threadId, void* addr, size_t size)
+    void PinHandler::handleThreadStart(THREADID threadId, ADDRINT stackPointer, size_t stackSize)
+    {
+        execCtxt.startThread(threadId, stackPointer, stackSize);
+    }
+
+    void PinHandler::handleThreadFini(THREADID threadId)
     {
         Locker locker(&lock, threadId);
+        execCtxt.finishThread(threadId);
+    }
+
+    //events of a thread go to its own buffer, the heap is locked by ExecContext when resolving online
+    void PinHandler::handleHeapAlloc(THREADID threadId, void* addr, size_t size)
+    {
         Event e(EventType::Alloc, threadId, addr, size);
         execCtxt.addEvent(e);
     }
 
+    //code is reinstrumented with or without accesses when recording starts or stops
+    void PinHandler::handleRegionBegin(THREADID threadId, const char* name)
+    {
+        PIN_LockClient();
+        if (execCtxt.beginRegion(threadId, name ? name : "roi"))
+        {
+            PIN_RemoveInstrumentation();
+        }
+        PIN_UnlockClient();
+    }
+
+    void PinHandler::handleRegionEnd(THREADID threadId)
+    {
+        PIN_LockClient();
+        if (execCtxt.endRegion(threadId))
+        {
+            PIN_RemoveInstrumentation();
+        }
+        PIN_UnlockClient();
+    }
+
     void PinHandler::handleHeapFree(THREADID threadId, void* addr)
     {
-        Locker locker(&lock, threadId);
         Event e(EventType::Free, threadId, addr);
         execCtxt.addEvent(e);
     }
 
+    //allocators call each other (operator new calls malloc, malloc may call mmap),
+    //only the outermost call is recorded
+    void PinHandler::handleAllocBefore(THREADID threadId, ADDRINT stackPointer, size_t size, ADDRINT arg)
+    {
+        PendingAlloc& pending = pendingAllocs[threadId];
+        if (pending.enter(stackPointer))
+        {
+            pending.size = size;
+            pending.arg = arg;
+        }
+    }
+
+    void PinHandler::handleAllocAfter(THREADID threadId, void* addr)
+    {
+        PendingAlloc& pending = pendingAllocs[threadId];
+        //the call may have started before the routine was instrumented
+        if (pending.depth == 0 || --pending.depth > 0)
+        {
+            return;
+        }
+        if (addr && pending.size > 0)
+        {
+            handleHeapAlloc(threadId, addr, pending.size);
+        }
+    }
+
+    void PinHandler::handleReallocAfter(THREADID threadId, void* addr)
+    {
+        PendingAlloc& pending = pendingAllocs[threadId];
+        if (pending.depth == 0 || --pending.depth > 0)
+        {
+            return;
+        }
+        //the old block stays allocated if the call fails, realloc(p, 0) frees it
+        void* oldAddr = (void*)pending.arg;
+        if (oldAddr && (addr || pending.size == 0))
+        {
+            handleHeapFree(threadId, oldAddr);
+        }
+        if (addr && pending.size > 0)
+        {
+            handleHeapAlloc(threadId, addr, pending.size);
+        }
+    }
+
+    void PinHandler::handleFreeBefore(THREADID threadId, ADDRINT stackPointer, void* addr)
+    {
+        PendingAlloc& pending = pendingAllocs[threadId];
+        if (pending.enter(stackPointer) && addr)
+        {
+            handleHeapFree(threadId, addr);
+        }
+    }
+
+    void PinHandler::handleFreeAfter(THREADID threadId)
+    {
+        PendingAlloc& pending = pendingAllocs[threadId];
+        if (pending.depth > 0)
+        {
+            pending.depth--;
+        }
+    }
+
+    ADDRINT PinHandler::getPendingArg(THREADID threadId) const
+    {
+        return pendingAllocs[threadId].arg;
+    }
+
     void PinHandler::handleRoutineEnter(CONTEXT* ctxt, THREADID threadId, int routineId)
     {
-        Locker locker(&lock, threadId);
         Event e(EventType::Call, threadId, routineId, (void*)PIN_GetContextReg(ctxt, REG_STACK_PTR));
         execCtxt.addEvent(e);
     }
 
     void PinHandler::handleRoutineExit(CONTEXT* ctxt, THREADID threadId, int routineId)
     {
-        Locker locker(&lock, threadId);
         Event e(EventType::Ret, threadId, routineId, (void*)PIN_GetContextReg(ctxt, REG_STACK_PTR));
         execCtxt.addEvent(e);
     }
 
-    void PinHandler::handleMemoryRead(THREADID threadId, void* addr, size_t size, VOID* ip)
+    void PinHandler::handleFullBuffer(THREADID threadId, UINT32 reserved)
     {
-        Locker locker(&lock, threadId);
-        Event e(EventType::Read, threadId, addr, size, (uint64_t)ip);
-        execCtxt.addEvent(e);
+        execCtxt.flushEvents(threadId, reserved);
     }
 
-    void PinHandler::handleMemoryWrite(THREADID threadId, void* addr, size_t size, VOID* ip)
+    //called at instrumentation time, under the client lock
+    bool PinHandler::acceptsRoutine(RTN rtn)
     {
-        Locker locker(&lock, threadId);
-        Event e(EventType::Write, threadId, addr, size, (uint64_t)ip);
-        execCtxt.addEvent(e);
+        if (filter.isEmpty())
+        {
+            return true;
+        }
+        if (!RTN_Valid(rtn))
+        {
+            return false;
+        }
+        auto it = acceptedRoutines.find(RTN_Address(rtn));
+        if (it != acceptedRoutines.end())
+        {
+            return it->second;
+        }
+        INT32 column;
+        INT32 line;
+        string fileName;
+        PIN_GetSourceLocation(RTN_Address(rtn), &column, &line, &fileName);
+        bool accepted = filter.accepts(RTN_Name(rtn), fileName);
+        acceptedRoutines[RTN_Address(rtn)] = accepted;
+        return accepted;
     }
 
     void PinHandler::instrumentRoutine(RTN rtn)
@@ -170,35 +396,288 @@ namespace pin
                        IARG_THREAD_ID, IARG_UINT32, id, IARG_END);
     }
 
+    //An operand addressed relative to the instruction pointer has a fixed address: its global
+    //variable is found once here and passed to the analysis routine, -1 if unknown.
+    //Returns false if accesses to the variable are filtered out
+    bool PinHandler::resolveOperand(INS ins, UINT32 instId, UINT32 memOp, INT32& varId)
+    {
+        varId = -1;
+        UINT32 op = INS_MemoryOperandIndexToOperandIndex(ins, memOp);
+        if (INS_OperandMemoryBaseReg(ins, op) != REG_INST_PTR ||
+            INS_OperandMemoryIndexReg(ins, op) != REG_INVALID() ||
+            INS_OperandMemorySegmentReg(ins, op) != REG_INVALID())
+        {
+            return true;
+        }
+        //relative to the next instruction
+        ADDRINT addr = INS_Address(ins) + INS_Size(ins) + INS_OperandMemoryDisplacement(ins, op);
+        auto* varInfo = execCtxt.bindStaticAccess(instId, addr);
+        if (!varInfo)
+        {
+            return true;
+        }
+        if (!filter.acceptsVar(varInfo->name))
+        {
+            return false;
+        }
+        varId = varInfo->id;
+        return true;
+    }
+
+    void PinHandler::insertAccess(INS ins, AFUNPTR access, UINT32 instId, UINT32 memOp, UINT32 size, INT32 varId)
+    {
+        INS_InsertIfPredicatedCall(
+            ins, IPOINT_BEFORE, access, IARG_FAST_ANALYSIS_CALL,
+            IARG_PTR, execCtxt.getEventBuffers(),
+            IARG_THREAD_ID,
+            IARG_UINT32, instId,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_UINT32, size,
+            IARG_UINT32, (UINT32)varId,
+            IARG_END);
+        INS_InsertThenPredicatedCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)mem::flush, IARG_FAST_ANALYSIS_CALL,
+            IARG_PTR, this,
+            IARG_THREAD_ID,
+            IARG_END);
+    }
+
+    //accesses of an instruction start with the same phase and are sampled together,
+    //phases of different instructions are spread over the period
+    UINT32* PinHandler::newInstCounter(UINT32 instId)
+    {
+        if (sampling.instPeriod == 0)
+        {
+            return nullptr;
+        }
+        instCounters.push_back(1 + instId % sampling.instPeriod);
+        return &instCounters.back();
+    }
+
+    void PinHandler::insertSampledAccess(INS ins, AFUNPTR record, UINT32 instId, UINT32 memOp, UINT32 size,
+                                         INT32 varId, UINT32* counter)
+    {
+        if (sampling.burstPeriod > 0 && counter)
+        {
+            INS_InsertIfPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR)mem::sampleBurstInst, IARG_FAST_ANALYSIS_CALL,
+                IARG_PTR, execCtxt.getEventBuffers(),
+                IARG_THREAD_ID,
+                IARG_UINT32, sampling.burstLength,
+                IARG_UINT32, sampling.burstPeriod,
+                IARG_PTR, counter,
+                IARG_UINT32, sampling.instPeriod,
+                IARG_END);
+        }
+        else if (counter)
+        {
+            INS_InsertIfPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR)mem::sampleInst, IARG_FAST_ANALYSIS_CALL,
+                IARG_PTR, counter,
+                IARG_UINT32, sampling.instPeriod,
+                IARG_END);
+        }
+        else
+        {
+            INS_InsertIfPredicatedCall(
+                ins, IPOINT_BEFORE, (AFUNPTR)mem::sampleBurst, IARG_FAST_ANALYSIS_CALL,
+                IARG_PTR, execCtxt.getEventBuffers(),
+                IARG_THREAD_ID,
+                IARG_UINT32, sampling.burstLength,
+                IARG_UINT32, sampling.burstPeriod,
+                IARG_END);
+        }
+        INS_InsertThenPredicatedCall(
+            ins, IPOINT_BEFORE, record, IARG_FAST_ANALYSIS_CALL,
+            IARG_PTR, this,
+            IARG_PTR, execCtxt.getEventBuffers(),
+            IARG_THREAD_ID,
+            IARG_UINT32, instId,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_UINT32, size,
+            IARG_UINT32, (UINT32)varId,
+            IARG_END);
+    }
+
+    void PinHandler::insertSlot(INS ins, AFUNPTR access, UINT32 slot, UINT32 instId, UINT32 memOp, UINT32 size,
+                                INT32 varId)
+    {
+        INS_InsertCall(
+            ins, IPOINT_BEFORE, access, IARG_FAST_ANALYSIS_CALL,
+            IARG_PTR, execCtxt.getEventBuffers(),
+            IARG_THREAD_ID,
+            IARG_UINT32, slot,
+            IARG_UINT32, instId,
+            IARG_MEMORYOP_EA, memOp,
+            IARG_UINT32, size,
+            IARG_UINT32, (UINT32)varId,
+            IARG_END);
+    }
+
+    //Accesses are batched only if the instruction always executes once and no other event
+    //can be recorded between the accesses of the segment (calls, returns, routine entries)
+    static bool isBatchable(INS ins)
+    {
+        if (INS_IsPredicated(ins) || INS_HasRealRep(ins) || INS_IsCall(ins) || INS_IsRet(ins))
+        {
+            return false;
+        }
+        RTN rtn = INS_Rtn(ins);
+        return !RTN_Valid(rtn) || RTN_Address(rtn) != INS_Address(ins);
+    }
+
+    UINT32 PinHandler::accessCount(INS ins)
+    {
+        UINT32 count = 0;
+        UINT32 instId = INS_MemoryOperandCount(ins) > 0 ? execCtxt.getInstId(ins) : 0;
+        for (UINT32 memOp = 0; memOp < INS_MemoryOperandCount(ins); memOp++)
+        {
+            INT32 varId;
+            if (!resolveOperand(ins, instId, memOp, varId))
+            {
+                continue;
+            }
+            count += INS_MemoryOperandIsRead(ins, memOp);
+            count += INS_MemoryOperandIsWritten(ins, memOp);
+        }
+        return count;
+    }
+
+    void PinHandler::instrumentTrace(TRACE trace)
+    {
+        for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+        {
+            if (!acceptsRoutine(INS_Rtn(BBL_InsHead(bbl))))
+            {
+                continue;
+            }
+            if (!execCtxt.recordsAccesses())
+            {
+                for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+                {
+                    instrumentInstruction(ins);
+                }
+                continue;
+            }
+            //split the block into segments of batchable instructions first: the reservation
+            //precedes the accesses of the first instruction and needs the size of the whole segment
+            std::vector<UINT32> sizes;
+            std::vector<int> segments;
+            std::vector<UINT32> firstSlots;
+            int segment = -1;
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            {
+                UINT32 count = accessCount(ins);
+                if (!isBatchable(ins))
+                {
+                    segment = -1;
+                }
+                else if (count > 0 && (segment < 0 || sizes[segment] + count > EventBuffer::MaxReserved))
+                {
+                    segment = sizes.size();
+                    sizes.push_back(0);
+                }
+                segments.push_back(segment);
+                firstSlots.push_back(segment < 0 ? 0 : sizes[segment]);
+                if (segment >= 0)
+                {
+                    sizes[segment] += count;
+                }
+            }
+
+            size_t i = 0;
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins), i++)
+            {
+                if (segments[i] < 0)
+                {
+                    instrumentInstruction(ins);
+                    continue;
+                }
+                if (accessCount(ins) == 0)
+                {
+                    continue;
+                }
+                UINT32 slot = firstSlots[i];
+                if (slot == 0)
+                {
+                    INS_InsertIfCall(
+                        ins, IPOINT_BEFORE, (AFUNPTR)mem::reserve, IARG_FAST_ANALYSIS_CALL,
+                        IARG_PTR, execCtxt.getEventBuffers(),
+                        IARG_THREAD_ID,
+                        IARG_UINT32, sizes[segments[i]],
+                        IARG_END);
+                    INS_InsertThenCall(
+                        ins, IPOINT_BEFORE, (AFUNPTR)mem::flushReserved, IARG_FAST_ANALYSIS_CALL,
+                        IARG_PTR, this,
+                        IARG_THREAD_ID,
+                        IARG_UINT32, sizes[segments[i]],
+                        IARG_END);
+                }
+                UINT32 instId = execCtxt.getInstId(ins);
+                for (UINT32 memOp = 0; memOp < INS_MemoryOperandCount(ins); memOp++)
+                {
+                    INT32 varId;
+                    if (!resolveOperand(ins, instId, memOp, varId))
+                    {
+                        continue;
+                    }
+                    UINT32 size = std::min<UINT32>(INS_MemoryOperandSize(ins, memOp), UINT8_MAX);
+                    if (INS_MemoryOperandIsRead(ins, memOp))
+                    {
+                        insertSlot(ins, (AFUNPTR)mem::memoryReadSlot, slot++, instId, memOp, size, varId);
+                    }
+                    if (INS_MemoryOperandIsWritten(ins, memOp))
+                    {
+                        insertSlot(ins, (AFUNPTR)mem::memoryWriteSlot, slot++, instId, memOp, size, varId);
+                    }
+                }
+            }
+        }
+    }
+
     void PinHandler::instrumentInstruction(INS ins)
     {
-        UINT32 memOperands = INS_MemoryOperandCount(ins);
+        if (!acceptsRoutine(INS_Rtn(ins)))
+        {
+            return;
+        }
+        //outside of regions only calls are instrumented
+        UINT32 memOperands = execCtxt.recordsAccesses() ? INS_MemoryOperandCount(ins) : 0;
+        //events carry the interned id instead of the instruction pointer
+        UINT32 instId = memOperands > 0 || INS_IsCall(ins) ? execCtxt.getInstId(ins) : 0;
         for (UINT32 memOp = 0; memOp < memOperands; memOp++)
         {
+            INT32 varId;
+            if (!resolveOperand(ins, instId, memOp, varId))
+            {
+                continue;
+            }
             bool f = false;
+            //event keeps 8 bits of the size
+            UINT32 size = std::min<UINT32>(INS_MemoryOperandSize(ins, memOp), UINT8_MAX);
             if (INS_MemoryOperandIsRead(ins, memOp))
             {
                 f = true;
-                auto size = INS_MemoryOperandSize(ins, memOp);
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)mem::memoryRead,
-                    IARG_PTR, this, IARG_INST_PTR,
-                    IARG_THREAD_ID,
-                    IARG_MEMORYOP_EA, memOp,
-                    IARG_UINT32, size,
-                    IARG_END);
+                if (sampling.isEnabled())
+                {
+                    insertSampledAccess(ins, (AFUNPTR)mem::recordRead, instId, memOp, size, varId, newInstCounter(instId));
+                }
+                else
+                {
+                    insertAccess(ins, (AFUNPTR)mem::memoryRead, instId, memOp, size, varId);
+                }
             }
             if (INS_MemoryOperandIsWritten(ins, memOp))
             {
                 f = true;
-                auto size = INS_MemoryOperandSize(ins, memOp);
-                INS_InsertPredicatedCall(
-                    ins, IPOINT_BEFORE, (AFUNPTR)mem::memoryWrite,
-                    IARG_PTR, this, IARG_INST_PTR,
-                    IARG_THREAD_ID,
-                    IARG_MEMORYOP_EA, memOp,
-                    IARG_UINT32, size,
-                    IARG_END);
+                if (sampling.isEnabled())
+                {
+                    insertSampledAccess(ins, (AFUNPTR)mem::recordWrite, instId, memOp, size, varId, newInstCounter(instId));
+                }
+                else
+                {
+                    insertAccess(ins, (AFUNPTR)mem::memoryWrite, instId, memOp, size, varId);
+                }
             }
             assert(f);
         }
@@ -221,13 +700,13 @@ namespace pin
             INS_InsertPredicatedCall(
                     ins, IPOINT_BEFORE, (AFUNPTR)callInstBefore,
                     IARG_PTR, this,
-                    IARG_THREAD_ID, IARG_INST_PTR,
+                    IARG_THREAD_ID, IARG_UINT32, instId,
                     IARG_UINT32, id,
                     IARG_END);
             INS_InsertPredicatedCall(
                     next, IPOINT_BEFORE, (AFUNPTR)callInstAfter,
                     IARG_PTR, this,
-                    IARG_THREAD_ID, IARG_INST_PTR,
+                    IARG_THREAD_ID, IARG_UINT32, instId,
                     IARG_UINT32, id,
                     IARG_END);
         }
@@ -236,6 +715,11 @@ namespace pin
     void PinHandler::instrumentImageLoad(IMG img)
     {
         bool external = IMG_Name(img) != binPath;
+        if (!external && RTN_Valid(RTN_FindByName(img, "bininst_roi_begin")))
+        {
+            cout << "ROI API found, accesses are recorded only in regions" << endl;
+            execCtxt.enableRegions();
+        }
         for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
         {
             for (RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn))
@@ -243,56 +727,141 @@ namespace pin
                 RTN_Open(rtn);
                 if (external)
                 {
-                    instrumentRoutineExternal(rtn);
+                    if (heapTracking)
+                    {
+                        instrumentRoutineExternal(rtn);
+                    }
                 }
-                else
+                //accesses and call instructions are instrumented by the instruction or trace callback,
+                //instrumentation of the image would be kept when the code is reinstrumented for regions
+                else if (acceptsRoutine(rtn))
                 {
                     instrumentRoutine(rtn);
-                    for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins))
-                    {
-                        instrumentInstruction(ins);
-                    }
+                    instrumentRegionApi(rtn);
+                }
+                //recording starts and ends with main
+                else if (filteredCalls || RTN_Name(rtn) == "main")
+                {
+                    instrumentRoutine(rtn);
+                    instrumentRegionApi(rtn);
+                }
+                else
+                {
+                    instrumentRegionApi(rtn);
                 }
                 RTN_Close(rtn);
             }
         }
     }
 
-    void PinHandler::instrumentRoutineExternal(RTN rtn)
+    //there may be a copy of the static functions of the API in every source file
+    void PinHandler::instrumentRegionApi(RTN rtn)
     {
         string name = RTN_Name(rtn);
-        if (name == "malloc" || name == "__libc_malloc")
+        if (name == "bininst_roi_begin")
         {
-            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::mallocBefore,
-                       IARG_PTR, this, IARG_THREAD_ID,
-                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
-            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::mallocAfter,
-                       IARG_PTR, this, IARG_THREAD_ID,
-                       IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)regionBegin,
+                           IARG_PTR, this, IARG_THREAD_ID,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
         }
-        if (name == "calloc" || name == "__libc_calloc")
+        else if (name == "bininst_roi_end")
         {
-            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::callocBefore,
-                       IARG_PTR, this, IARG_THREAD_ID,
-                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
-                       IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
-                       IARG_END);
-            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::callocAfter,
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)regionEnd,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_END);
+        }
+    }
+
+    //mangled names of operator new and delete, with nothrow and aligned variants
+    static const set<string> newNames = {
+        "_Znwm", "_Znam", "_ZnwmRKSt9nothrow_t", "_ZnamRKSt9nothrow_t",
+        "_ZnwmSt11align_val_t", "_ZnamSt11align_val_t",
+        "_ZnwmSt11align_val_tRKSt9nothrow_t", "_ZnamSt11align_val_tRKSt9nothrow_t"
+    };
+    static const set<string> deleteNames = {
+        "_ZdlPv", "_ZdaPv", "_ZdlPvm", "_ZdaPvm", "_ZdlPvRKSt9nothrow_t", "_ZdaPvRKSt9nothrow_t",
+        "_ZdlPvSt11align_val_t", "_ZdaPvSt11align_val_t", "_ZdlPvmSt11align_val_t", "_ZdaPvmSt11align_val_t"
+    };
+
+    void PinHandler::instrumentAllocator(RTN rtn, AFUNPTR before, UINT32 argCount, AFUNPTR after)
+    {
+        if (argCount == 1)
+        {
+            RTN_InsertCall(rtn, IPOINT_BEFORE, before,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+        }
+        else
+        {
+            RTN_InsertCall(rtn, IPOINT_BEFORE, before,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_END);
+        }
+        RTN_InsertCall(rtn, IPOINT_AFTER, after,
                        IARG_PTR, this, IARG_THREAD_ID,
                        IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+    }
+
+    void PinHandler::instrumentRoutineExternal(RTN rtn)
+    {
+        string name = RTN_Name(rtn);
+        if (name == "malloc" || name == "__libc_malloc" || name == "valloc" || name == "pvalloc" ||
+            newNames.count(name))
+        {
+            instrumentAllocator(rtn, (AFUNPTR)mem::allocBefore, 1, (AFUNPTR)mem::allocAfter);
+        }
+        else if (name == "calloc" || name == "__libc_calloc")
+        {
+            instrumentAllocator(rtn, (AFUNPTR)mem::callocBefore, 2, (AFUNPTR)mem::allocAfter);
+        }
+        else if (name == "realloc" || name == "__libc_realloc")
+        {
+            instrumentAllocator(rtn, (AFUNPTR)mem::reallocBefore, 2, (AFUNPTR)mem::reallocAfter);
+        }
+        //the size is the second argument, after the alignment
+        else if (name == "aligned_alloc" || name == "memalign" || name == "__libc_memalign")
+        {
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::allocBefore,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 1, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::allocAfter,
+                           IARG_PTR, this, IARG_THREAD_ID,
+                           IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        }
+        else if (name == "posix_memalign")
+        {
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::memalignBefore,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 2, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::memalignAfter,
+                           IARG_PTR, this, IARG_THREAD_ID,
+                           IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
+        }
+        else if (name == "mmap" || name == "mmap64")
+        {
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::mmapBefore,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 3, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::mmapAfter,
+                           IARG_PTR, this, IARG_THREAD_ID,
+                           IARG_FUNCRET_EXITPOINT_VALUE, IARG_END);
         }
-        else if (name == "free" || name == "__libc_free")
+        //only whole mappings are tracked, a partial munmap of the start frees the object too
+        else if (name == "free" || name == "__libc_free" || name == "munmap" || deleteNames.count(name))
         {
             RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)mem::freeBefore,
-                       IARG_PTR, this, IARG_THREAD_ID,
-                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_REG_VALUE, REG_STACK_PTR,
+                           IARG_FUNCARG_ENTRYPOINT_VALUE, 0, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)mem::freeAfter,
+                           IARG_PTR, this, IARG_THREAD_ID, IARG_END);
         }
     }
 
-    void PinHandler::handleCallInst(ADDRINT instAddr, THREADID threadId, int routineId)
+    void PinHandler::handleCallInst(UINT32 instId, THREADID threadId, int routineId)
     {
-        Locker locker(&lock, threadId);
-        Event e(EventType::CallInst, threadId, routineId, nullptr, instAddr);
+        Event e(EventType::CallInst, threadId, routineId, nullptr, instId);
         execCtxt.addEvent(e);
     }
 
@@ -300,4 +869,9 @@ namespace pin
     {
         return execCtxt.dumpEvents();
     }
+
+    Profile PinHandler::dumpProfile()
+    {
+        return execCtxt.dumpProfile();
+    }
 } //namespace pin
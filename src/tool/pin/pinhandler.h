@@ -4,29 +4,91 @@
 #include <stack>
 #include <map>
 #include <set>
+#include <unordered_map>
 #include <cstdint>
+#include <deque>
 #include "pin.H"
 #include "common/debuginfo/debugcontext.h"
 #include "common/event/eventmanager.h"
 #include "execcontext.h"
+#include "tooloptions.h"
 
 namespace pin
 {
+    //allocator call in progress in a thread
+    struct PendingAlloc
+    {
+        //nesting of tracked allocator calls
+        UINT32 depth = 0;
+        size_t size = 0;
+        //realloc: the old block, posix_memalign: where the address is returned
+        ADDRINT arg = 0;
+        //at the entry of the outermost call
+        ADDRINT stackPointer = 0;
+
+        //returns true for the outermost call. A call that never returned (operator new throwing,
+        //longjmp) leaves its depth behind, a call from its frame or above starts over
+        bool enter(ADDRINT sp)
+        {
+            if (depth > 0 && sp >= stackPointer)
+            {
+                depth = 0;
+            }
+            if (depth++ > 0)
+            {
+                return false;
+            }
+            stackPointer = sp;
+            return true;
+        }
+    };
+
     class PinHandler
     {
         const std::string binPath;
         PIN_LOCK lock;
 
         ExecContext execCtxt;
+        trace::Sampling sampling;
+        //countdowns of instruction sampling, deque keeps the addresses passed to the analysis routines
+        std::deque<UINT32> instCounters;
+        InstrumentationFilter filter;
+        bool filteredCalls;
+        //decisions of the filter by routine address
+        std::unordered_map<ADDRINT, bool> acceptedRoutines;
+        bool heapTracking;
+        //by thread id
+        std::vector<PendingAlloc> pendingAllocs;
+
+        bool acceptsRoutine(RTN rtn);
+        bool resolveOperand(INS ins, UINT32 instId, UINT32 memOp, INT32& varId);
+        UINT32 accessCount(INS ins);
+
+        void insertAccess(INS ins, AFUNPTR access, UINT32 instId, UINT32 memOp, UINT32 size, INT32 varId);
+        UINT32* newInstCounter(UINT32 instId);
+        void insertSampledAccess(INS ins, AFUNPTR record, UINT32 instId, UINT32 memOp, UINT32 size, INT32 varId,
+                                 UINT32* counter);
+        void instrumentAllocator(RTN rtn, AFUNPTR before, UINT32 argCount, AFUNPTR after);
+        void insertSlot(INS ins, AFUNPTR access, UINT32 slot, UINT32 instId, UINT32 memOp, UINT32 size, INT32 varId);
 
     public:
-        PinHandler(const std::string& binPath, dbginfo::DebugContext& dbgCtxt);
+        PinHandler(const std::string& binPath, dbginfo::DebugContext& dbgCtxt, const ToolOptions& options);
+        void handleThreadStart(THREADID threadId, ADDRINT stackPointer, size_t stackSize);
+        void handleThreadFini(THREADID threadId);
         void handleHeapAlloc(THREADID threadId, void* addr, size_t size);
         void handleHeapFree(THREADID threadId, void* addr);
+        void handleAllocBefore(THREADID threadId, ADDRINT stackPointer, size_t size, ADDRINT arg = 0);
+        //addr is null if the allocation failed
+        void handleAllocAfter(THREADID threadId, void* addr);
+        void handleReallocAfter(THREADID threadId, void* addr);
+        void handleFreeBefore(THREADID threadId, ADDRINT stackPointer, void* addr);
+        void handleFreeAfter(THREADID threadId);
+        ADDRINT getPendingArg(THREADID threadId) const;
         void handleRoutineEnter(CONTEXT* ctxt, THREADID threadId, int routineId);
         void handleRoutineExit(CONTEXT* ctxt, THREADID threadId, int routineId);
-        void handleMemoryRead(THREADID threadId, void* addr, size_t size, VOID* ip);
-        void handleMemoryWrite(THREADID threadId, void* addr, size_t size, VOID* ip);
+        void handleFullBuffer(THREADID threadId, UINT32 reserved);
+        void handleRegionBegin(THREADID threadId, const char* name);
+        void handleRegionEnd(THREADID threadId);
 
         void instrumentImageLoad(IMG img);
         void instrumentRoutine(RTN rtn);
@@ -34,8 +96,10 @@ namespace pin
         void instrumentInstruction(INS ins);
 
         void instrumentRoutineExternal(RTN rtn);
-        void handleCallInst(ADDRINT instAddr, THREADID threadId, int routineId);
+        void instrumentRegionApi(RTN rtn);
+        void handleCallInst(UINT32 instId, THREADID threadId, int routineId);
 
         EventManager dumpEvents();
+        Profile dumpProfile();
     };
 } //namespace pin
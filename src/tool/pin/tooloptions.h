@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "common/event/blockcodec.h"
+#include "common/event/traceformat.h"
+#include "config.h"
+#include "instrumentationfilter.h"
+
+namespace pin
+{
+    //tool settings collected from the pintool command line
+    struct ToolOptions
+    {
+        std::string eventPath = BIN_EVENT_PATH;
+        //events per buffer and trace block
+        size_t blockSize = 1 << 20;
+        //buffers shared by threads waiting for the writer, besides one per thread
+        size_t spareBuffers = 4;
+        trace::Codec codec = trace::Codec::None;
+        int compressionLevel = 1;
+        //batch the accesses of basic blocks instead of instrumenting every instruction
+        bool traceInstrumentation = false;
+        //resolve varIds while capturing instead of a pass over the trace at exit
+        bool onlineResolution = false;
+        //allocations become dynamic variables accesses are attributed to
+        bool heapTracking = true;
+        //aggregate access counts while capturing and write a profile instead of a trace,
+        //accesses are resolved online
+        bool profile = false;
+        //memory accesses to record, recorded in the trace header
+        trace::Sampling sampling;
+        //routines whose accesses are recorded, others get only call/ret events or nothing
+        InstrumentationFilter filter;
+        bool filteredCalls = true;
+    };
+} //namespace pin
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <map>
@@ -17,16 +18,208 @@
 static pin::PinHandler* pinHandler;
 static dwarf::DwarfParser* parser;
 static dbginfo::DebugContext dbgCtxt;
+static bool profileMode = false;
+
+KNOB<string> KnobCompression(KNOB_MODE_WRITEONCE, "pintool", "compress", "none",
+                             "trace block compression: none, lz or zstd");
+KNOB<int> KnobCompressionLevel(KNOB_MODE_WRITEONCE, "pintool", "compress_level", "1",
+                               "trace block compression level");
+KNOB<UINT32> KnobBlockSize(KNOB_MODE_WRITEONCE, "pintool", "block_size", "1048576",
+                           "number of events per trace block of a thread");
+KNOB<UINT32> KnobBuffers(KNOB_MODE_WRITEONCE, "pintool", "buffers", "4",
+                         "number of spare event buffers shared by threads while full ones are written");
+KNOB<string> KnobInstrumentation(KNOB_MODE_WRITEONCE, "pintool", "instrument", "ins",
+                                 "instrumentation granularity: ins or trace (accesses batched per basic block, without sampling)");
+KNOB<UINT32> KnobSampleBurst(KNOB_MODE_WRITEONCE, "pintool", "sample_burst", "0",
+                             "record bursts of this many memory accesses of a thread, 0 records all");
+KNOB<UINT32> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool", "sample_period", "0",
+                              "number of memory accesses of a thread between the starts of bursts");
+KNOB<double> KnobSampleRate(KNOB_MODE_WRITEONCE, "pintool", "sample_rate", "1",
+                            "fraction of the executions of each memory instruction to record, 1/n for a whole n");
+KNOB<string> KnobIncludeFunc(KNOB_MODE_APPEND, "pintool", "include_func", "",
+                             "record accesses only of routines matching this regex, may be repeated");
+KNOB<string> KnobExcludeFunc(KNOB_MODE_APPEND, "pintool", "exclude_func", "",
+                             "don't record accesses of routines matching this regex, may be repeated");
+KNOB<string> KnobIncludeFile(KNOB_MODE_APPEND, "pintool", "include_file", "",
+                             "record accesses only of routines from source files matching this regex, may be repeated");
+KNOB<string> KnobExcludeFile(KNOB_MODE_APPEND, "pintool", "exclude_file", "",
+                             "don't record accesses of routines from source files matching this regex, may be repeated");
+KNOB<string> KnobIncludeVar(KNOB_MODE_APPEND, "pintool", "include_var", "",
+                            "record accesses to global variables addressed directly by the code only if they match this regex, may be repeated");
+KNOB<string> KnobExcludeVar(KNOB_MODE_APPEND, "pintool", "exclude_var", "",
+                            "don't record accesses to global variables addressed directly by the code matching this regex, may be repeated");
+KNOB<string> KnobFiltered(KNOB_MODE_WRITEONCE, "pintool", "filtered", "calls",
+                          "events of filtered out routines: calls (call/ret only) or none");
+KNOB<string> KnobHeap(KNOB_MODE_WRITEONCE, "pintool", "heap", "on",
+                      "track allocations (malloc family, new/delete, anonymous mmap) as dynamic variables: on or off");
+KNOB<string> KnobMode(KNOB_MODE_WRITEONCE, "pintool", "mode", "trace",
+                      "output: trace (every event) or profile (access counts aggregated during capture)");
+KNOB<string> KnobResolve(KNOB_MODE_WRITEONCE, "pintool", "resolve", "exit",
+                         "when variables of accesses are resolved: exit (pass over the trace) or online (during capture)");
+
+static bool parseFilter(pin::InstrumentationFilter& filter)
+{
+    try
+    {
+        for (UINT32 i = 0; i < KnobIncludeFunc.NumberOfValues(); i++)
+        {
+            filter.includeFunc(KnobIncludeFunc.Value(i));
+        }
+        for (UINT32 i = 0; i < KnobExcludeFunc.NumberOfValues(); i++)
+        {
+            filter.excludeFunc(KnobExcludeFunc.Value(i));
+        }
+        for (UINT32 i = 0; i < KnobIncludeFile.NumberOfValues(); i++)
+        {
+            filter.includeFile(KnobIncludeFile.Value(i));
+        }
+        for (UINT32 i = 0; i < KnobExcludeFile.NumberOfValues(); i++)
+        {
+            filter.excludeFile(KnobExcludeFile.Value(i));
+        }
+        for (UINT32 i = 0; i < KnobIncludeVar.NumberOfValues(); i++)
+        {
+            filter.includeVar(KnobIncludeVar.Value(i));
+        }
+        for (UINT32 i = 0; i < KnobExcludeVar.NumberOfValues(); i++)
+        {
+            filter.excludeVar(KnobExcludeVar.Value(i));
+        }
+    }
+    catch (const std::regex_error& e)
+    {
+        cerr << "Invalid filter pattern: " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool parseOptions(pin::ToolOptions& options)
+{
+    if (!trace::parseCodec(KnobCompression.Value(), &options.codec))
+    {
+        cerr << "Unknown compression: " << KnobCompression.Value() << endl;
+        return false;
+    }
+    if (!trace::isCodecAvailable(options.codec))
+    {
+        cerr << "Compression is not available: " << KnobCompression.Value() << endl;
+        return false;
+    }
+    options.compressionLevel = KnobCompressionLevel.Value();
+    options.blockSize = KnobBlockSize.Value();
+    if (options.blockSize == 0)
+    {
+        cerr << "Block size must be positive" << endl;
+        return false;
+    }
+    options.spareBuffers = KnobBuffers.Value();
+    if (options.spareBuffers == 0)
+    {
+        cerr << "Number of buffers must be positive" << endl;
+        return false;
+    }
+    if (KnobInstrumentation.Value() == "trace")
+    {
+        options.traceInstrumentation = true;
+    }
+    else if (KnobInstrumentation.Value() != "ins")
+    {
+        cerr << "Unknown instrumentation: " << KnobInstrumentation.Value() << endl;
+        return false;
+    }
+    if (!parseFilter(options.filter))
+    {
+        return false;
+    }
+    if (KnobFiltered.Value() == "none")
+    {
+        options.filteredCalls = false;
+    }
+    else if (KnobFiltered.Value() != "calls")
+    {
+        cerr << "Unknown mode of filtered routines: " << KnobFiltered.Value() << endl;
+        return false;
+    }
+    if (KnobResolve.Value() == "online")
+    {
+        options.onlineResolution = true;
+    }
+    else if (KnobResolve.Value() != "exit")
+    {
+        cerr << "Unknown resolution mode: " << KnobResolve.Value() << endl;
+        return false;
+    }
+    if (KnobHeap.Value() == "off")
+    {
+        options.heapTracking = false;
+    }
+    else if (KnobHeap.Value() != "on")
+    {
+        cerr << "Unknown heap tracking mode: " << KnobHeap.Value() << endl;
+        return false;
+    }
+    if (KnobMode.Value() == "profile")
+    {
+        //counts are aggregated by variable, so accesses have to be resolved before aggregation
+        options.profile = true;
+        options.onlineResolution = true;
+    }
+    else if (KnobMode.Value() != "trace")
+    {
+        cerr << "Unknown mode: " << KnobMode.Value() << endl;
+        return false;
+    }
+    if (KnobSampleBurst.Value() > 0)
+    {
+        if (KnobSamplePeriod.Value() < KnobSampleBurst.Value())
+        {
+            cerr << "Sampling period must not be shorter than the burst" << endl;
+            return false;
+        }
+        options.sampling.burstLength = KnobSampleBurst.Value();
+        options.sampling.burstPeriod = KnobSamplePeriod.Value();
+    }
+    double rate = KnobSampleRate.Value();
+    if (rate <= 0 || rate > 1)
+    {
+        cerr << "Sampling rate must be in (0, 1]" << endl;
+        return false;
+    }
+    //every n-th execution is recorded, other rates would be recorded as the nearest 1/n
+    double period = 1 / rate;
+    if (period + 0.5 > UINT32_MAX || std::abs(period - std::round(period)) > 1e-6 * period)
+    {
+        cerr << "Sampling rate must be 1/n for a whole n, e.g. 0.5 or 0.01" << endl;
+        return false;
+    }
+    UINT32 instPeriod = (UINT32)std::round(period);
+    if (instPeriod > 1)
+    {
+        options.sampling.instPeriod = instPeriod;
+    }
+    if (options.traceInstrumentation && options.sampling.isEnabled())
+    {
+        cerr << "Sampling is not supported in trace mode" << endl;
+        return false;
+    }
+    if (options.traceInstrumentation && options.blockSize <= pin::EventBuffer::MaxReserved)
+    {
+        cerr << "Block size must be larger than " << pin::EventBuffer::MaxReserved << " in trace mode" << endl;
+        return false;
+    }
+    return true;
+}
 
 VOID Instruction(INS ins, VOID *v)
 {
     pinHandler->instrumentInstruction(ins);
 }
 
-//VOID Trace(TRACE trace, VOID *v)
-//{
- //   pinHandler->instrumentTrace(trace);
-//}
+VOID Trace(TRACE trace, VOID *v)
+{
+    pinHandler->instrumentTrace(trace);
+}
 
 VOID ImageLoad(IMG img, VOID* v)
 {
@@ -35,7 +228,6 @@ VOID ImageLoad(IMG img, VOID* v)
 
 VOID ThreadStart(THREADID threadId, CONTEXT *ctxt, INT32 flags, VOID *v)
 {
-    //ADDRINT stackBase = PIN_GetContextReg(ctxt, REG_STACK_PTR);
     struct rlimit rlim;
     if (getrlimit(RLIMIT_STACK, &rlim))
     {
@@ -48,18 +240,33 @@ VOID ThreadStart(THREADID threadId, CONTEXT *ctxt, INT32 flags, VOID *v)
         cerr << "\n Need a finite stack size. Dont use unlimited.\n";
         PIN_ExitProcess(-1);
     }
+    //stacks of new threads get the default size of the limit too
+    ADDRINT stackPointer = PIN_GetContextReg(ctxt, REG_STACK_PTR);
+    pinHandler->handleThreadStart(threadId, stackPointer, rlim.rlim_cur);
 }
 
 VOID ThreadFini(THREADID threadId, const CONTEXT* ctxt, INT32 code, VOID *v)
 {
+    pinHandler->handleThreadFini(threadId);
 }
 
 VOID Fini(INT32 code, VOID *v)
 {
-    EventManager eventManager = pinHandler->dumpEvents();
-
-    std::ofstream outEvent(EVENT_REF_PATH, std::ios::binary);
-    eventManager.save(outEvent);
+    //query.exe reads the output of the last run, so the other one is removed
+    if (profileMode)
+    {
+        Profile profile = pinHandler->dumpProfile();
+        std::ofstream outProfile(PROFILE_PATH, std::ios::binary);
+        profile.save(outProfile);
+        std::remove(EVENT_REF_PATH.c_str());
+    }
+    else
+    {
+        EventManager eventManager = pinHandler->dumpEvents();
+        std::ofstream outEvent(EVENT_REF_PATH, std::ios::binary);
+        eventManager.save(outEvent);
+        std::remove(PROFILE_PATH.c_str());
+    }
 
     std::ofstream outDbg(DEBUG_INFO_PATH, std::ios::binary);
     dbgCtxt.save(outDbg);
@@ -85,17 +292,27 @@ int main(int argc, char* argv[])
     parser->cuWalk(bind(&dwarf::DwarfParser::walk, parser, placeholders::_1, placeholders::_2));
     dbgCtxt = parser->getDwarfContext().toDbg();
 
-    pinHandler = new pin::PinHandler(binPath, dbgCtxt);
-
     PIN_InitSymbols();
     if (PIN_Init(argc, argv))
         return -1;
 
+    pin::ToolOptions options;
+    if (!parseOptions(options))
+        return -1;
+    profileMode = options.profile;
+    pinHandler = new pin::PinHandler(binPath, dbgCtxt, options);
+
     cout << "======= PIN" << endl;
     PIN_AddThreadStartFunction(ThreadStart, 0);
     PIN_AddThreadFiniFunction(ThreadFini, 0);
-    INS_AddInstrumentFunction(Instruction, 0);
-    //TRACE_AddInstrumentFunction(Trace, 0);
+    if (options.traceInstrumentation)
+    {
+        TRACE_AddInstrumentFunction(Trace, 0);
+    }
+    else
+    {
+        INS_AddInstrumentFunction(Instruction, 0);
+    }
     IMG_AddInstrumentFunction(ImageLoad, 0);
     PIN_AddFiniUnlockedFunction(Fini, 0);
 
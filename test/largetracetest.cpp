@@ -0,0 +1,198 @@
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+#include "common/event/eventmanager.h"
+#include "common/event/tracereader.h"
+#include "common/event/tracewriter.h"
+using namespace std;
+
+//Checks that traces with more than 2^31 events are addressed correctly.
+//The traces are synthetic: v2 trace repeats one compressed block,
+//raw (v1) trace is a sparse file with events at its head and tail.
+
+static const uint64_t TotalEvents = (1ULL << 31) + (1ULL << 20);
+static const uint32_t BlockEvents = 1 << 20;
+static const string V2_PATH = "largetrace.bin";
+static const string RAW_PATH = "largetrace.raw";
+
+static Event makeEvent(uint64_t i)
+{
+    Event e(EventType::Read, 0, (void*)(0x1000 + i % 16 * 8), 8, 1);
+    e.t = 0;
+    e.memoryEvent.varId = 1;
+    return e;
+}
+
+static void testV2(const dbginfo::DebugContext& dbgCtxt)
+{
+    //write one block and replicate it with the index
+    std::vector<Event> events;
+    for (uint32_t i = 0; i < BlockEvents; i++)
+    {
+        events.push_back(makeEvent(i));
+    }
+    TraceWriter writer;
+    writer.setCompression(trace::Codec::Lz, 1);
+    bool opened = writer.open(V2_PATH, dbgCtxt);
+    assert(opened);
+    writer.writeBlock(events.data(), events.size());
+    writer.close();
+
+    TraceReader reader;
+    opened = reader.open(V2_PATH);
+    assert(opened);
+    auto block = reader.getBlock(0);
+    auto summary = reader.getSummary(0);
+    std::vector<char> payload(block.payloadSize);
+    {
+        std::ifstream in(V2_PATH, std::ios::binary);
+        in.seekg(block.offset);
+        in.read(payload.data(), payload.size());
+    }
+    reader.close();
+
+    trace::BlockHeader header;
+    header.eventCount = block.eventCount;
+    header.payloadSize = block.payloadSize;
+    header.rawSize = block.rawSize;
+    header.codec = block.codec;
+    header.level = block.level;
+
+    uint64_t blockCount = TotalEvents / BlockEvents;
+    std::ofstream out(V2_PATH, std::ios::binary | std::ios::trunc);
+    utils::save(trace::TraceHeader(), out);
+    std::vector<uint64_t> offsets;
+    for (uint64_t i = 0; i < blockCount; i++)
+    {
+        utils::save(header, out);
+        offsets.push_back(out.tellp());
+        out.write(payload.data(), payload.size());
+    }
+    trace::IndexTrailer trailer;
+    trailer.indexOffset = out.tellp();
+    trailer.blockCount = blockCount;
+    for (uint64_t i = 0; i < blockCount; i++)
+    {
+        trace::BlockIndexEntry entry;
+        entry.offset = offsets[i];
+        entry.header = header;
+        utils::save(entry, out);
+        //block number is kept as time to let the filter pick blocks
+        summary.minT = summary.maxT = i;
+        summary.save(out);
+    }
+    utils::save(trailer, out);
+    out.close();
+
+    EventManager em(dbgCtxt, V2_PATH, TotalEvents);
+    assert(em.size() == TotalEvents);
+    em.setBlockFilter([&](const trace::BlockSummary& s)
+    {
+        return s.minT == 0 || s.minT >= blockCount - 2;
+    });
+    uint64_t seen = 0;
+    while (em.hasNext())
+    {
+        Event& e = em.next();
+        assert(e.type == EventType::Read);
+        assert(e.memoryEvent.addr == makeEvent(seen % BlockEvents).memoryEvent.addr);
+        seen++;
+    }
+    assert(seen == 3ULL * BlockEvents);
+    std::remove(V2_PATH.c_str());
+    cout << "v2: " << TotalEvents << " events OK" << endl;
+}
+
+static trace::V1Event makeV1Event(uint64_t i)
+{
+    trace::V1Event e = {};
+    e.type = (int32_t)EventType::Write;
+    e.memoryEvent.t = 1000 + i;
+    e.memoryEvent.threadId = 1;
+    e.memoryEvent.addr = 0x2000 + i % 16 * 4;
+    e.memoryEvent.size = 4;
+    e.memoryEvent.instAddr = 0x400000 + i % 2;
+    e.memoryEvent.varId = 2;
+    return e;
+}
+
+static void testRaw(dbginfo::DebugContext& dbgCtxt)
+{
+    const uint64_t headEvents = 16;
+    const uint64_t tailEvents = 16;
+    int fd = open(RAW_PATH.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd != -1);
+    int ret = ftruncate(fd, TotalEvents * sizeof(trace::V1Event));
+    assert(ret == 0);
+    auto writeEvent = [&](uint64_t i)
+    {
+        trace::V1Event e = makeV1Event(i);
+        ssize_t written = pwrite(fd, &e, sizeof(e), i * sizeof(e));
+        assert(written == sizeof(e));
+    };
+    for (uint64_t i = 0; i < headEvents; i++)
+    {
+        writeEvent(i);
+    }
+    for (uint64_t i = TotalEvents - tailEvents; i < TotalEvents; i++)
+    {
+        writeEvent(i);
+    }
+    close(fd);
+    uint32_t instIds[2] = {dbgCtxt.addInst(0x400000), dbgCtxt.addInst(0x400001)};
+
+    TraceReader reader;
+    bool opened = reader.open(RAW_PATH, &dbgCtxt);
+    assert(opened);
+    assert(reader.getVersion() == 1);
+    assert(reader.getTotalEvents() == TotalEvents);
+    for (size_t block: {(size_t)0, reader.getBlockCount() - 1})
+    {
+        auto& info = reader.getBlock(block);
+        Event* events = reader.loadBlock(block);
+        for (uint64_t i = info.firstEvent; i < info.firstEvent + info.eventCount; i++)
+        {
+            if (i >= headEvents && i < TotalEvents - tailEvents)
+            {
+                continue;
+            }
+            auto& e = events[i - info.firstEvent];
+            auto v1 = makeV1Event(i);
+            assert(e.type == EventType::Write);
+            assert(e.getThreadId() == 1);
+            assert(e.getTime() == i);
+            assert((uint64_t)e.memoryEvent.addr == v1.memoryEvent.addr);
+            assert(e.getSize() == 4);
+            assert(e.getInstId() == instIds[i % 2]);
+            assert(e.memoryEvent.varId == 2);
+        }
+    }
+    reader.close();
+
+    //instruction addresses can't be translated without the debug context
+    bool rejected = false;
+    try
+    {
+        reader.open(RAW_PATH);
+    }
+    catch (const std::runtime_error&)
+    {
+        rejected = true;
+    }
+    assert(rejected && !reader.isOpen());
+    std::remove(RAW_PATH.c_str());
+    cout << "raw: " << TotalEvents << " events OK" << endl;
+}
+
+int main()
+{
+    dbginfo::DebugContext dbgCtxt;
+    testV2(dbgCtxt);
+    testRaw(dbgCtxt);
+    return 0;
+}